@@ -617,7 +617,17 @@ char *acl_current_user_privilege_set(const dav_resource * resource)
     pool = db_r->p;
     user = apr_pstrdup(pool, resource->info->rec->user);
     dbms_get_principal_id_from_name(pool, db, user, &principal_id);
-    privileges = dbms_get_privileges(db, pool, principal_id, db_r->serialno);
+
+    /* rendered from the privileges granted as a bitmask, when it can be */
+    privilege_set_xml = dbms_get_privilege_set_xml(db, resource->info->rec,
+                                                   pool, principal_id,
+                                                   db_r->serialno);
+    if (privilege_set_xml)
+        return privilege_set_xml;
+    privilege_set_xml = "";
+
+    privileges = dbms_get_privileges(db, resource->info->rec, pool,
+                                     principal_id, db_r->serialno);
 
     iter = dav_privilege_iterate(privileges);
     while (dav_privilege_iterator_more(iter)) {
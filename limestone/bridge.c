@@ -20,7 +20,6 @@
 #include "bridge.h"
 #include "dbms.h"
 #include "dbms_bind.h"
-#include "dbms_redirect.h"      /* dbms_get_redirect_props */
 #include "dbms_deltav.h"
 
 #include "util.h"
@@ -29,10 +28,131 @@
 #include "version.h" /* for dav_repos_version_control */
 #include "dbms_principal.h"
 #include "dbms_quota.h"
+#include "dbms_api.h"          /* for dbms_api_epoch */
 
 #include <apr_strings.h>
 #include <apr_uuid.h>
 
+/* a resource as sabridge_get_property loaded it */
+typedef struct {
+    const dav_repos_dbms *db;   /* the handle it was read through */
+    int epoch;                  /* dbms_api_epoch of db when it was read */
+    dav_repos_resource res;
+} sabridge_loaded_resource;
+
+/**
+ * Copies the properties sabridge_get_property fills in
+ * @param pool - Where to duplicate the strings, NULL to share them
+ * @param with_bind - Also copy what depends on the bind the resource was
+ * reached through
+ */
+static void sabridge_copy_loaded(apr_pool_t *pool, dav_repos_resource *dst,
+                                 const dav_repos_resource *src, int with_bind)
+{
+#define LOADED_STR(s) (pool ? apr_pstrdup(pool, s) : (s))
+
+    dst->serialno = src->serialno;
+    if (with_bind) {
+        dst->bind_id = src->bind_id;
+        dst->updated_at = LOADED_STR(src->updated_at);
+    }
+    dst->created_at = LOADED_STR(src->created_at);
+    dst->lastmodified = LOADED_STR(src->lastmodified);
+    dst->displayname = LOADED_STR(src->displayname);
+    dst->getcontentlanguage = LOADED_STR(src->getcontentlanguage);
+    dst->getcontenttype = LOADED_STR(src->getcontenttype);
+    dst->getcontentlength = src->getcontentlength;
+    dst->resourcetype = src->resourcetype;
+    dst->creator_id = src->creator_id;
+    dst->owner_id = src->owner_id;
+    dst->uuid = pool ? apr_pstrdup(pool, src->uuid) : src->uuid;
+    dst->creator_displayname = LOADED_STR(src->creator_displayname);
+    dst->comment = LOADED_STR(src->comment);
+    dst->root_version_id = src->root_version_id;
+    dst->autoversion_type = src->autoversion_type;
+    dst->lastversion = src->lastversion;
+    dst->checked_id = src->checked_id;
+    dst->checked_state = src->checked_state;
+    dst->vr_num = src->vr_num;
+    dst->version = src->version;
+    dst->vcr_id = src->vcr_id;
+    dst->vhr_id = src->vhr_id;
+    dst->sha1str = LOADED_STR(src->sha1str);
+    dst->redirect_lifetime = src->redirect_lifetime;
+    dst->reftarget = LOADED_STR(src->reftarget);
+    dst->av_new_children = src->av_new_children;
+    dst->limebar_state = LOADED_STR(src->limebar_state);
+    dst->next = NULL;
+
+#undef LOADED_STR
+}
+
+static request_rec *sabridge_resource_rec(const dav_repos_resource *r)
+{
+    if (r->resource && r->resource->info)
+        return r->resource->info->rec;
+    return NULL;
+}
+
+/**
+ * Fills r in from what this request already loaded, either by r's serialno
+ * or, without one, by r's URI
+ * @return 1 if it was there and nothing was written since
+ */
+static int sabridge_recall_resource(const dav_repos_db *d,
+                                    dav_repos_resource *r)
+{
+    request_rec *rec = sabridge_resource_rec(r);
+    dav_repos_cache *cache;
+    sabridge_loaded_resource *loaded;
+
+    if (!rec)
+        return 0;
+
+    cache = sabridge_get_cache(rec);
+    if (r->serialno)
+        loaded = apr_hash_get(cache->resources_by_id, &r->serialno,
+                              sizeof(r->serialno));
+    else if (r->uri)
+        loaded = apr_hash_get(cache->resources_by_uri, r->uri,
+                              APR_HASH_KEY_STRING);
+    else
+        return 0;
+
+    if (!loaded || loaded->db != d->db
+        || loaded->epoch != dbms_api_epoch(d->db))
+        return 0;
+
+    sabridge_copy_loaded(NULL, r, &loaded->res, !r->serialno);
+    return 1;
+}
+
+/* remembers r for the rest of the request, see sabridge_recall_resource */
+static void sabridge_remember_resource(const dav_repos_db *d,
+                                       const dav_repos_resource *r,
+                                       int by_uri)
+{
+    request_rec *rec = sabridge_resource_rec(r);
+    dav_repos_cache *cache;
+    sabridge_loaded_resource *loaded;
+    int epoch = dbms_api_epoch(d->db);
+
+    if (!rec || epoch < 0)
+        return;
+
+    cache = sabridge_get_cache(rec);
+    loaded = apr_pcalloc(cache->pool, sizeof(*loaded));
+    loaded->db = d->db;
+    loaded->epoch = epoch;
+    sabridge_copy_loaded(cache->pool, &loaded->res, r, by_uri);
+
+    apr_hash_set(cache->resources_by_id, &loaded->res.serialno,
+                 sizeof(loaded->res.serialno), loaded);
+    if (by_uri)
+        apr_hash_set(cache->resources_by_uri, apr_pstrdup(cache->pool, r->uri),
+                     APR_HASH_KEY_STRING, loaded);
+}
+
 dav_error *sabridge_get_property(const dav_repos_db *d, dav_repos_resource *r)
 {
     apr_pool_t *pool = r->p;
@@ -43,6 +163,9 @@ dav_error *sabridge_get_property(const dav_repos_db *d, dav_repos_resource *r)
 
     TRACE();
 
+    if (sabridge_recall_resource(d, r))
+        return NULL;
+
     if (r->serialno)
         serialno = r->serialno;
     else if (r->uri && r->root_path && strstr(r->uri, r->root_path)) {
@@ -60,10 +183,12 @@ dav_error *sabridge_get_property(const dav_repos_db *d, dav_repos_resource *r)
         return err;
 
     r->serialno = serialno;
-    dbms_get_resource(d, r);
+    err = dbms_get_resource_full(d, r);
+    if (err) return err;
 
     if (uri_not_found && r->resourcetype != dav_repos_REDIRECT) {
         r->serialno = r->resourcetype = r->owner_id = r->creator_id = 0;
+        r->av_new_children = 0;
         r->created_at = r->displayname = r->getcontentlanguage = NULL;
         r->comment = NULL;
         r->next = NULL;
@@ -74,34 +199,30 @@ dav_error *sabridge_get_property(const dav_repos_db *d, dav_repos_resource *r)
     if (bind) {
         r->bind_id = bind->bind_id;
         r->updated_at = bind->updated_at;
+
+        /* binds resolved from the cache leave the resource's own
+         * modification time out */
+        if (!uri_not_found && r->lastmodified && r->updated_at
+            && strcmp(r->lastmodified, r->updated_at) > 0)
+            r->updated_at = r->lastmodified;
     }
 
-    if (r->resourcetype == dav_repos_REDIRECT) {
-        dbms_get_redirect_props(d, r);
-        if (bind) {
-            const char *absent_uri;
-            if (bind->uri)
-                absent_uri = r->uri + strlen(bind->uri);
-            else
-                absent_uri = "";
-            r->reftarget = apr_pstrcat(pool, r->reftarget, absent_uri, NULL);
-        }
+    if (r->resourcetype == dav_repos_REDIRECT && bind) {
+        const char *absent_uri;
+        if (bind->uri)
+            absent_uri = r->uri + strlen(bind->uri);
+        else
+            absent_uri = "";
+        r->reftarget = apr_pstrcat(pool, r->reftarget, absent_uri, NULL);
     }
 
+    /* collection contenttype hack */
     if (r->resourcetype == dav_repos_COLLECTION
-        || r->resourcetype == dav_repos_VERSIONED_COLLECTION) {
-        err = dbms_get_collection_props(d, r);
-        if (err) return err;
-        
-        /* collection contenttype hack */
+        || r->resourcetype == dav_repos_VERSIONED_COLLECTION)
         r->getcontenttype = apr_pstrdup(r->p, DIR_MAGIC_TYPE);
-        if (err) return err;
-    }
-
-    if((err = dbms_get_media_props(d, r)))
-        return err;
 
-    err = dbms_get_deltav_props(d, r);
+    if (!err && r->resourcetype && !uri_not_found)
+        sabridge_remember_resource(d, r, bind != NULL);
 
     return err;
 }
@@ -377,9 +498,8 @@ dav_error *sabridge_get_collection_children(const dav_repos_db *db,
 {
     apr_hash_t *retr_rs; /* hash storing retrieved resources */
     dav_error *err = NULL;
-    dav_repos_resource *link_head, *link_tail;
-    dav_repos_resource *next_level_children, *next_level_tail;
-    int num_new_items, total_items;
+    dav_repos_resource *link_head, *link_tail, *iter;
+    int total_items;
 
     TRACE();
 
@@ -389,37 +509,26 @@ dav_error *sabridge_get_collection_children(const dav_repos_db *db,
         return NULL;
     }
 
-    err = dbms_get_collection_resource(db, db_r, db_r, acl_priv,
-                                       &link_head, &link_tail, &num_new_items);
-    if (err) return err;
-    total_items = num_new_items;
+    if (depth == DAV_INFINITY) {
+        /* the whole tree in one query, binds already marked */
+        err = dbms_get_descendants(db, db_r, acl_priv, &link_head, &link_tail,
+                                   &total_items);
+        if (err) return err;
+    } else {
+        err = dbms_get_collection_resource(db, db_r, db_r, acl_priv,
+                                           &link_head, &link_tail,
+                                           &total_items);
+        if (err) return err;
 
-    retr_rs = apr_hash_make(db_r->p);
-    apr_hash_set(retr_rs, &(db_r->serialno), sizeof(long), (void*)db_r);
-    
-    next_level_children = link_head;
-    while (next_level_children) {
-        dav_repos_resource *iter = next_level_children;
-        do {
-            iter->bind = apr_hash_get(retr_rs, &(iter->serialno), sizeof(long));
+        retr_rs = apr_hash_make(db_r->p);
+        apr_hash_set(retr_rs, &(db_r->serialno), sizeof(long), (void*)db_r);
+
+        for (iter = link_head; iter; iter = iter->next) {
+            iter->bind = apr_hash_get(retr_rs, &(iter->serialno),
+                                      sizeof(long));
             /* associate the id with the last retrieved bind to it */
             apr_hash_set(retr_rs, &(iter->serialno), sizeof(long), iter);
-        } while ((iter = iter->next) != NULL);
-
-        if (depth == DAV_INFINITY) {
-            /* update next_level_children to the next level */
-            err = dbms_get_collection_resource
-              (db, next_level_children, next_level_tail, acl_priv, 
-               &next_level_children, &next_level_tail, &num_new_items);
-            if (err) return err;
-
-            if (next_level_children) {
-                link_tail->next = next_level_children;
-                link_tail = next_level_tail;
-                total_items += num_new_items;
-            }
-
-        } else next_level_children = next_level_tail = NULL;
+        }
     }
 
     /* pass on the children to the caller */
@@ -430,6 +539,23 @@ dav_error *sabridge_get_collection_children(const dav_repos_db *db,
     return NULL;
 }
 
+dav_error *sabridge_stream_collection_children(const dav_repos_db *db,
+                                               dav_repos_resource *db_r,
+                                               int depth,
+                                               const char *acl_priv,
+                                               int columns,
+                                               dbms_children_page *page,
+                                               dbms_children_fn fn, void *baton)
+{
+    TRACE();
+
+    if (depth == 0)
+        return NULL;
+
+    return dbms_stream_descendants(db, db_r, depth, acl_priv, columns,
+                                   depth == 1 ? page : NULL, fn, baton);
+}
+
 dav_error *sabridge_copy_medium_w_create(const dav_repos_db *d,
                                          dav_repos_resource *r_src,
                                          dav_repos_resource *r_dst,
@@ -1253,9 +1379,13 @@ dav_repos_cache *sabridge_get_cache(request_rec *r)
     dav_repos_cache *cache = (dav_repos_cache *)apr_table_get(root->notes, "dav_repos_cache");
     if (!cache) {
         cache = (dav_repos_cache *)apr_pcalloc(root->pool, sizeof(*cache));
+        cache->pool = root->pool;
         cache->principal_type = apr_hash_make(root->pool);
         cache->namespaces = apr_hash_make(root->pool);
         cache->privileges = apr_hash_make(root->pool);
+        cache->resources_by_uri = apr_hash_make(root->pool);
+        cache->resources_by_id = apr_hash_make(root->pool);
+        cache->acl_entries = apr_hash_make(root->pool);
     }
 
     apr_table_setn(root->notes, "dav_repos_cache", (char *)cache);
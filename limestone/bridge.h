@@ -111,6 +111,30 @@ dav_error *sabridge_get_collection_children(const dav_repos_db *db,
                                             dav_repos_resource **plink_tail,
                                             int *num_items);
 
+/**
+ * Like sabridge_get_collection_children, but hands the children to fn a
+ * batch at a time as they are read rather than all at once; see
+ * dbms_stream_descendants for how long the children live
+ *
+ * @param db handle to the database
+ * @param db_r the collection whose children are to be retrieved
+ * @param depth can be 0, 1 or DAV_INFINITY as per the RFC2518
+ * @param acl_priv The privilege to filter by
+ * @param columns The DBMS_CHILD_ flags of the tables to read
+ * @param page The page of children to read when depth is 1, NULL for all
+ * @param fn The function to call for each batch of children
+ * @param baton Passed to fn
+ *
+ * @return NULL on success, error otherwise
+ */
+dav_error *sabridge_stream_collection_children(const dav_repos_db *db,
+                                               dav_repos_resource *db_r,
+                                               int depth,
+                                               const char *acl_priv,
+                                               int columns,
+                                               dbms_children_page *page,
+                                               dbms_children_fn fn, void *baton);
+
 /**
  * Copy a medium-resource, create the destination if it doesn't exist
  * @param db The DB connection struct
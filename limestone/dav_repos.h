@@ -39,15 +39,24 @@
  * in functions returning int */
 #define LS_ERROR        -INT_MAX
 
-/* REMOVE DEBUG INFO */
+/* Debug output is only compiled in by configure --with-debug; use
+ * DAVLimestoneTraceHeader / DAVLimestoneTraceSample to trace SQL */
 #undef DBG0
 #undef DBG1
 #undef DBG2
 #undef DBG3
+#ifdef DEBUG
 #define DBG0(A) printf(A)
 #define DBG1(A,B) printf(A,B)
 #define DBG2(A,B,C) printf(A,B,C)
 #define DBG3(A,B,C,D) printf(A,B,C,D)
+#else
+/* never evaluated, but keeps the arguments "used" for -Werror builds */
+#define DBG0(A) ((void)(0 && printf(A)))
+#define DBG1(A,B) ((void)(0 && printf(A,B)))
+#define DBG2(A,B,C) ((void)(0 && printf(A,B,C)))
+#define DBG3(A,B,C,D) ((void)(0 && printf(A,B,C,D)))
+#endif
 /*
 #include <http_log.h>
 #define DBG0(f)          ap_log_error(APLOG_MARK, APLOG_ERR, 0, NULL,\
@@ -105,6 +114,8 @@ int dav_repos_get_type_id(const char *type);
 
 struct dav_repos_dbms;
 typedef struct dav_repos_dbms dav_repos_dbms;
+struct dbms_replica;
+typedef struct dbms_replica dbms_replica;
 #endif
 
 typedef struct {
@@ -140,6 +151,36 @@ typedef struct {
     const char *db_driver;
     enum { UNKNOWN = 0, MYSQL = 1, PGSQL = 2 } dbms;
     const char *db_params;
+    int fetch_size;     /* rows per cursor fetch for large SELECTs, -1 for off */
+    const char *trace_header;   /* requests with this header get SQL traced */
+    int trace_sample;   /* trace one in every trace_sample requests */
+    int repeat_warn;    /* warn when a query runs more often in a request */
+    int repeat_budget;  /* fail queries run more often (debug builds only) */
+    int xaction_retries;        /* reruns after serialization failures */
+    apr_off_t retry_body_limit; /* largest request body kept for reruns */
+    const char *read_only_xaction; /* characteristics of read-only
+                                    * transactions, NULL to turn them off */
+    int read_only_xaction_set;
+    const char *replica_driver; /* read replica serving read-only requests */
+    const char *replica_params;
+    int replica_sticky;         /* seconds reads stay on the primary after
+                                 * a write the replica may not have yet */
+    dbms_replica *replica;      /* per child, set up in child_init */
+    int bind_cache_size;        /* binds cached per process, -1 for none */
+    int bind_cache_ttl;         /* seconds a bind is served for */
+    int response_cache_size;    /* bytes of PROPFIND responses and indexes
+                                 * cached per process, -1 for none */
+    int response_cache_ttl;     /* seconds a response is served for */
+    apr_uint32_t response_generation; /* per request, read before the
+                                       * request reads anything */
+    int acl_cache_size;         /* ACL entries cached per process, -1 for
+                                 * none */
+    int acl_cache_ttl;          /* seconds an ACL entry is served for */
+    apr_uint32_t acl_generation; /* per request, like response_generation */
+    int group_cache_size;       /* group closures cached per process, -1 for
+                                 * none */
+    int group_cache_ttl;        /* seconds a group closure is served for */
+    apr_uint32_t group_generation; /* per request, like response_generation */
 
     int use_gc;
     int keep_files;
@@ -157,9 +198,13 @@ typedef dav_repos_server_conf dav_repos_db;
 
 
 typedef struct {
+    apr_pool_t *pool;
     apr_hash_t *principal_type; // user or group
     apr_hash_t *namespaces;
     apr_hash_t *privileges;
+    apr_hash_t *resources_by_uri; // resources loaded by sabridge_get_property
+    apr_hash_t *resources_by_id;
+    apr_hash_t *acl_entries; // ACL entries loaded, see dbms_acl.c
 } dav_repos_cache;
 
 /* our hooks structures; these are gathered into a dav_provider */
@@ -191,6 +236,11 @@ dav_error *dav_repos_create_resource(dav_resource *resource, int params);
 dav_error *dav_repos_new_resource(request_rec *r, const char *root_path, 
                                   dav_resource **result_resource);
 
+/* same as dav_repos_new_resource, allocating the resource from pool */
+dav_error *dav_repos_new_resource_in_pool(request_rec *r, apr_pool_t *pool,
+                                          const char *root_path,
+                                          dav_resource **result_resource);
+
 void dav_repos_register_profile_provider(apr_pool_t *p, const char *name, 
                                          const dav_repos_profile_provider *hooks);
 
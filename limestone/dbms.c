@@ -46,6 +46,8 @@
 #include "lock.h"
 #include "dbms.h"
 #include "dbms_bind.h"          /* for inserting and removing binds */
+#include "dbms_bind_cache.h"    /* for dbms_bind_cache_invalidate */
+#include "dbms_acl_cache.h"     /* for dbms_acl_cache_invalidate */
 #include "dbms_principal.h"     /* for inserting and removing binds */
 #include "util.h"               /* for time_apr_to_str */
 #include "bridge.h"             /* for sabridge_new_dbr_from_dbr */
@@ -74,22 +76,31 @@ void db_error_message(apr_pool_t * pool, const dav_repos_dbms * db,
                  db_error_message_str, dbms_error(pool, db));
 }
 
-dav_error *dbms_select_unique_id(apr_pool_t *pool, const dav_repos_db *d,
-                                 const char *unique_id)
+/* per-request settings on a freshly acquired handle */
+static void dbms_request_setup(dav_repos_db *d, request_rec *r)
 {
-    dav_repos_query *q = NULL;
-    dav_error *err = NULL;
+    /* requests are correlated through a comment on each statement
+     * rather than a round trip of their own */
+    dbms_api_set_tag(d->db, apr_table_get(r->subprocess_env, "UNIQUE_ID"));
+    dbms_api_set_trace(d->db, dbms_trace_start(r, d->trace_header,
+                                               d->trace_sample));
+    dbms_api_set_repeat_limits(d->db, d->repeat_warn, d->repeat_budget);
+}
 
-    TRACE();
+/* pooled connections keep their session settings between requests */
+static int dbms_session_setup(dav_repos_db *d, apr_pool_t *p, int iso_level)
+{
+    if (dbms_api_session_ready(d->db))
+        return 0;
 
-    q = dbms_prepare(pool, d->db, "SELECT ?");
-    dbms_set_string(q, 1, apr_pstrcat(pool, "UNIQUE_ID ", unique_id, NULL));
+    if (APR_SUCCESS != dbms_set_session_xaction_iso_level(p, d, iso_level)) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, NULL,
+                     "dbms_opendb: Error setting transaction isolation level");
+        return -1;
+    }
+    dbms_api_set_session_ready(d->db);
 
-    if (dbms_execute(q))
-        err = dav_new_error(pool, HTTP_INTERNAL_SERVER_ERROR, 0, 
-                            "couldn't SELECT UNIQUE_ID");
-    dbms_query_destroy(q);
-    return err;
+    return 0;
 }
 
 int dbms_opendb(dav_repos_db * d, apr_pool_t *p, request_rec * r,
@@ -98,28 +109,65 @@ int dbms_opendb(dav_repos_db * d, apr_pool_t *p, request_rec * r,
     TRACE();
 
     if (r) {
-        const char *unique_id = apr_table_get(r->subprocess_env, "UNIQUE_ID");
         d->db = dbms_api_opendb(p, r);
         if (!d->db)
             ap_log_error(APLOG_MARK, APLOG_ERR, 0, NULL,
                          "dbms_opendb: Error acquiring a database connection");
-            
-        if (d->db && unique_id)
-            dbms_select_unique_id(p, d, unique_id);
+        else
+            dbms_request_setup(d, r);
     } else
         d->db = dbms_api_opendb_params(p, db_driver, db_params);
 
     if (d->db == NULL)
         return -1;
 
-    if (APR_SUCCESS != 
-        dbms_set_session_xaction_iso_level(p, d, SERIALIZABLE)) {
-        ap_log_error(APLOG_MARK, APLOG_ERR, 0, NULL,
-                     "dbms_opendb: Error setting transaction isolation level");
+    return dbms_session_setup(d, p, SERIALIZABLE);
+}
+
+int dbms_opendb_replica(dav_repos_db *d, apr_pool_t *p, request_rec *r)
+{
+    TRACE();
+
+    d->db = dbms_api_opendb_replica(p, r, d->replica);
+    if (d->db == NULL)
         return -1;
-    }
+    dbms_request_setup(d, r);
 
-    return 0;
+    /* hot standbys refuse SERIALIZABLE; a read-only snapshot is as good */
+    d->read_only_xaction = "ISOLATION LEVEL REPEATABLE READ READ ONLY";
+    return dbms_session_setup(d, p, REPEATABLE_READ);
+}
+
+long dbms_get_current_txid(apr_pool_t *pool, const dav_repos_db *d)
+{
+    dav_repos_query *q;
+    long txid = 0;
+
+    TRACE();
+
+    q = dbms_prepare(pool, d->db, "SELECT txid_current()");
+    if (dbms_execute(q) == 0 && dbms_next(q) == 1)
+        txid = dbms_get_int(q, 1);
+    dbms_query_destroy(q);
+
+    return txid;
+}
+
+int dbms_txid_visible(apr_pool_t *pool, const dav_repos_db *d, long txid)
+{
+    dav_repos_query *q;
+    int visible = 0;
+
+    TRACE();
+
+    q = dbms_prepare(pool, d->db, "SELECT txid_visible_in_snapshot(?, "
+                     "txid_current_snapshot())");
+    dbms_set_int(q, 1, txid);
+    if (dbms_execute(q) == 0 && dbms_next(q) == 1)
+        visible = !strcmp(dbms_get_string(q, 1), "t");
+    dbms_query_destroy(q);
+
+    return visible;
 }
 
 void dbms_closedb(dav_repos_db * d)
@@ -141,7 +189,7 @@ dav_error *dbms_get_resource(const dav_repos_db *d, dav_repos_resource *r)
     q = dbms_prepare(r->p, d->db, 
                      "SELECT r.created_at, r.displayname, r.contentlanguage, "
                      "r.owner_id, r.comment, r.creator_id, r.type, r.uuid, "
-                     "r.limebar_state "
+                     "r.limebar_state, r.lastmodified "
                      "FROM resources r WHERE r.id = ?");
     dbms_set_int(q, 1, r->serialno);
     if (dbms_execute(q)) {
@@ -175,6 +223,165 @@ dav_error *dbms_get_resource(const dav_repos_db *d, dav_repos_resource *r)
     r->uuid = dbms_get_string(q, 8);
     r->uuid[32] = '\0';
     r->limebar_state = dbms_get_string(q, 9);
+    r->lastmodified = dbms_get_string(q, 10);
+
+    dbms_query_destroy(q);
+    return err;
+}
+
+dav_error *dbms_get_resource_full(const dav_repos_db *d,
+                                  dav_repos_resource *r)
+{
+    int ierrno = 0;
+    dav_repos_query *q = NULL;
+    dav_error *err = NULL;
+    char *checked_state;
+
+    TRACE();
+
+    /* one row holding everything sabridge_get_property used to gather with
+     * dbms_get_resource, dbms_get_collection_props, dbms_get_media_props,
+     * dbms_get_redirect_props and dbms_get_deltav_props; the columns that
+     * don't apply to the resource's type come back NULL */
+    q = dbms_prepare(r->p, d->db, 
+                     "SELECT r.created_at, r.displayname, r.contentlanguage, "
+                     "r.owner_id, r.comment, r.creator_id, r.type, r.uuid, "
+                     "r.limebar_state, r.lastmodified, "
+                     "c.auto_version_new_children, "
+                     "m.size, m.mimetype, m.sha1, "
+                     "rr.lifetime, rr.reftarget, "
+                     "vc.checked_state, vc.checked_id, vc.vhr_id, "
+                     "vc.version_type, cv.number, "
+                     "v.number, v.vcr_id, vv.checked_id, p.name, "
+                     "hv.resource_id, hv.checked_state, hv.checked_id, "
+                     "vh.root_version_id "
+                     "FROM resources r "
+                     "LEFT OUTER JOIN collections c ON c.resource_id = r.id "
+                     "LEFT OUTER JOIN media m ON m.resource_id = r.id "
+                     "LEFT OUTER JOIN redirectrefs rr "
+                     "ON rr.resource_id = r.id "
+                     "LEFT OUTER JOIN vcrs vc ON vc.resource_id = r.id "
+                     "LEFT OUTER JOIN versions cv "
+                     "ON cv.resource_id = vc.checked_id "
+                     "LEFT OUTER JOIN versions v ON v.resource_id = r.id "
+                     "LEFT OUTER JOIN vcrs vv ON vv.resource_id = v.vcr_id "
+                     "LEFT OUTER JOIN principals p "
+                     "ON p.resource_id = r.creator_id "
+                     "LEFT OUTER JOIN vhrs vh ON vh.resource_id = r.id "
+                     "LEFT OUTER JOIN vcrs hv ON hv.resource_id = "
+                     "(SELECT resource_id FROM vcrs WHERE vhr_id = r.id "
+                     "ORDER BY resource_id LIMIT 1) "
+                     "WHERE r.id = ?");
+    dbms_set_int(q, 1, r->serialno);
+    if (dbms_execute(q)) {
+        dbms_query_destroy(q);
+        return dav_new_error(r->p, HTTP_INTERNAL_SERVER_ERROR, 0, 
+                "dbms_execute error");
+    }
+
+    if ((ierrno = dbms_next(q)) < 0) {
+        dbms_query_destroy(q);
+        return dav_new_error(r->p, HTTP_INTERNAL_SERVER_ERROR, 0,
+                "dbms_next error");
+    }
+
+    if (ierrno == 0) {
+        dbms_query_destroy(q);
+        return err;
+    }
+
+    r->resourcetype = dav_repos_get_type_id(dbms_get_string(q, 7));
+    r->created_at = dbms_get_string(q, 1);
+    r->displayname = dbms_get_string(q, 2);
+    r->getcontentlanguage = dbms_get_string(q, 3);
+    r->owner_id = dbms_get_int(q, 4);
+    r->comment = dbms_get_string(q, 5);
+    r->creator_id = dbms_get_int(q, 6);
+
+    DBG1("ResourceType: %d\n", r->resourcetype);
+    
+    r->next = NULL;
+    r->uuid = dbms_get_string(q, 8);
+    r->uuid[32] = '\0';
+    r->limebar_state = dbms_get_string(q, 9);
+    r->lastmodified = dbms_get_string(q, 10);
+
+    switch (r->resourcetype) {
+    case dav_repos_COLLECTION:
+    case dav_repos_VERSIONED_COLLECTION:
+        if (*dbms_get_string(q, 11))
+            r->av_new_children = dbms_get_int(q, 11);
+        break;
+    case dav_repos_REDIRECT:
+        if (r->redirect_lifetime && r->reftarget)
+            break;
+        if (!*dbms_get_string(q, 15)) {
+            err = dav_new_error(r->p, HTTP_INTERNAL_SERVER_ERROR, 0,
+                                "DBMS error in reftargets lookup.");
+            break;
+        }
+        if (0 == apr_strnatcmp(dbms_get_string(q, 15), "p")) 
+            r->redirect_lifetime = DAV_REDIRECTREF_PERMANENT;
+        else
+            r->redirect_lifetime = DAV_REDIRECTREF_TEMPORARY;
+        r->reftarget = dbms_get_string(q, 16);
+        break;
+    }
+
+    if ((r->resourcetype == dav_repos_RESOURCE
+         || r->resourcetype == dav_repos_VERSIONED
+         || r->resourcetype == dav_repos_VERSION)
+        && *dbms_get_string(q, 12)) {
+        r->getcontentlength = dbms_get_int(q, 12);
+        r->getcontenttype = dbms_get_string(q, 13);
+        r->sha1str = dbms_get_string(q, 14);
+    }
+
+    switch (r->resourcetype) {
+    case dav_repos_VERSIONED:
+    case dav_repos_VERSIONED_COLLECTION:
+        checked_state = dbms_get_string(q, 17);
+        if (!*checked_state) {
+            r->checked_state = DAV_RESOURCE_NOT_VERSIONED;
+            break;
+        }
+        r->checked_state = checked_state[0]=='I'? 
+          DAV_RESOURCE_CHECKED_IN : DAV_RESOURCE_CHECKED_OUT;
+        r->checked_id = dbms_get_int(q, 18);
+        r->vhr_id = dbms_get_int(q, 19);
+        r->autoversion_type = dbms_get_int(q, 20);
+        if (!*dbms_get_string(q, 21)) {
+            err = dav_new_error(r->p, HTTP_INTERNAL_SERVER_ERROR, 0,
+                                "Could not lookup version number");
+            break;
+        }
+        r->vr_num = dbms_get_int(q, 21);
+        break;
+    case dav_repos_VERSION:
+    case dav_repos_COLLECTION_VERSION:
+        if (*dbms_get_string(q, 22)) {
+            r->version = dbms_get_int(q, 22);
+            r->vcr_id = dbms_get_int(q, 23);
+            if (*dbms_get_string(q, 24)
+                && dbms_get_int(q, 24) == r->serialno)
+                r->lastversion = 1;
+        }
+        r->creator_displayname = dbms_get_string(q, 25);
+        if (!*r->creator_displayname)
+            r->creator_displayname = NULL;
+        break;
+    case dav_repos_VERSIONHISTORY:
+        if (!*dbms_get_string(q, 26))
+            break;
+        r->vcr_id = dbms_get_int(q, 26);
+        checked_state = dbms_get_string(q, 27);
+        r->checked_state = checked_state[0]=='I'? 
+          DAV_RESOURCE_CHECKED_IN : DAV_RESOURCE_CHECKED_OUT;
+        r->checked_id = dbms_get_int(q, 28);
+        if (*dbms_get_string(q, 29))
+            r->root_version_id = dbms_get_int(q, 29);
+        break;
+    }
 
     dbms_query_destroy(q);
     return err;
@@ -580,6 +787,20 @@ dav_error *dbms_delete_resource(const dav_repos_db * d, apr_pool_t *pool,
                      "DELETE FROM resources WHERE id=?");
     dbms_set_int(q, 1, db_r->serialno);
 
+    /* takes its binds along */
+    dbms_bind_cache_invalidate();
+
+    /* and the ACEs of a principal, or those its ACL children inherit */
+    switch (db_r->resourcetype) {
+    case dav_repos_PRINCIPAL:
+    case dav_repos_USER:
+    case dav_repos_GROUP:
+    case dav_repos_COLLECTION:
+    case dav_repos_VERSIONED_COLLECTION:
+        dbms_acl_cache_invalidate();
+        break;
+    }
+
     if (dbms_execute(q)) {
         dbms_query_destroy(q);
         return dav_new_error(pool, HTTP_INTERNAL_SERVER_ERROR, 0,
@@ -690,7 +911,7 @@ dav_error *dbms_fill_dead_property(const dav_repos_db * d,
     if (db_r->ns_id_hash == NULL)
         db_r->ns_id_hash = apr_hash_make(pool);
 
-    if (db_r->pr) {
+    if (db_r->pr || db_r->pr_filled) {
         /* nothing to do, properties already filled */
         return NULL;
     }
@@ -743,10 +964,331 @@ dav_error *dbms_fill_dead_property(const dav_repos_db * d,
     }           
 
     dbms_query_destroy(q);
+    db_r->pr_filled = 1;
 
     return err;
 }
 
+dav_error *dbms_fill_dead_properties(const dav_repos_db *d,
+                                     apr_pool_t *pool,
+                                     dav_repos_resource *resources,
+                                     const apr_array_header_t *names)
+{
+    dav_repos_resource *iter, *first;
+    dav_repos_property *pr, **ptail;
+    dav_repos_query *q = NULL;
+    apr_hash_t *by_id, *tails;
+    const char *ids = NULL, *name_filter = "";
+    int i, ierrno;
+
+    TRACE();
+
+    /* one resource of each id gets the properties, the others share them */
+    by_id = apr_hash_make(pool);
+    tails = apr_hash_make(pool);
+    for (iter = resources; iter; iter = iter->next) {
+        if (iter->pr || iter->pr_filled)
+            continue;
+        if (apr_hash_get(by_id, &iter->serialno, sizeof(long)))
+            continue;
+        apr_hash_set(by_id, &iter->serialno, sizeof(long), iter);
+        apr_hash_set(tails, &iter->serialno, sizeof(long), &iter->pr);
+        ids = ids ? apr_psprintf(pool, "%s,%ld", ids, iter->serialno)
+          : apr_psprintf(pool, "%ld", iter->serialno);
+    }
+
+    if (ids == NULL)
+        return NULL;
+
+    if (names && names->nelts == 0)
+        name_filter = " AND FALSE";
+    else if (names)
+        for (i = 0; i < names->nelts; i++)
+            name_filter = apr_pstrcat
+              (pool, name_filter, i ? " OR " : " AND (",
+               "(namespaces.name = ? AND properties.name = ?)",
+               i == names->nelts - 1 ? ")" : "", NULL);
+
+    q = dbms_prepare(pool, d->db,
+                     apr_pstrcat
+                     (pool, "SELECT resource_id, namespace_id, properties.name, "
+                      "xmlinfo, value, namespaces.name "
+                      "FROM properties "
+                      "INNER JOIN namespaces "
+                      "ON namespace_id=namespaces.id "
+                      "WHERE resource_id = ANY(CAST(? AS BIGINT[]))",
+                      name_filter, " ORDER BY properties.name", NULL));
+    dbms_set_string(q, 1, apr_pstrcat(pool, "{", ids, "}", NULL));
+    if (names)
+        for (i = 0; i < names->nelts; i++) {
+            const dav_prop_name *name = &APR_ARRAY_IDX(names, i, dav_prop_name);
+            dbms_set_string(q, 2 * i + 2, name->ns);
+            dbms_set_string(q, 2 * i + 3, name->name);
+        }
+
+    if (dbms_execute(q)) {
+        dbms_query_destroy(q);
+        return dav_new_error(pool, HTTP_INTERNAL_SERVER_ERROR, 0,
+                             "dbms_execute error");
+    }
+
+    while ((ierrno = dbms_next(q)) == 1) {
+        long serialno = dbms_get_int(q, 1);
+
+        ptail = apr_hash_get(tails, &serialno, sizeof(long));
+        if (ptail == NULL)
+            continue;
+        first = apr_hash_get(by_id, &serialno, sizeof(long));
+
+        pr = apr_pcalloc(first->p, sizeof(*pr));
+        pr->serialno = serialno;
+        pr->ns_id = dbms_get_int(q, 2);
+        pr->name = apr_pstrdup(first->p, dbms_get_string(q, 3));
+        pr->xmlinfo = apr_pstrdup(first->p, dbms_get_string(q, 4));
+        pr->value = apr_pstrdup(first->p, dbms_get_string(q, 5));
+        pr->namespace_name = apr_pstrdup(first->p, dbms_get_string(q, 6));
+
+        *ptail = pr;
+        apr_hash_set(tails, apr_pmemdup(pool, &serialno, sizeof(long)),
+                     sizeof(long), &pr->next);
+    }
+    dbms_query_destroy(q);
+
+    if (ierrno < 0)
+        return dav_new_error(pool, HTTP_INTERNAL_SERVER_ERROR, 0,
+                             "Failed when fetching dead props");
+
+    for (iter = resources; iter; iter = iter->next) {
+        first = apr_hash_get(by_id, &iter->serialno, sizeof(long));
+        if (first == NULL || iter->pr_filled || (iter->pr && iter != first))
+            continue;
+        iter->pr = first->pr;
+        iter->pr_filled = 1;
+
+        if (iter->ns_id_hash == NULL)
+            iter->ns_id_hash = apr_hash_make(iter->p);
+        for (pr = iter->pr; pr; pr = pr->next)
+            apr_hash_set(iter->ns_id_hash, pr->namespace_name,
+                         APR_HASH_KEY_STRING, &pr->ns_id);
+    }
+
+    return NULL;
+}
+
+/**
+ * The common table expressions dbms_child_grantdeny_exp relies on, for the
+ * children whose resource_id children_query selects: the groups of the
+ * principal, the privileges implying acl_priv, and the ACE winning on the
+ * ACL parent of each of the children, worked out once per parent. The
+ * groups come from the group cache, spliced in as an array of ids
+ */
+static const char *dbms_child_acl_ctes(apr_pool_t *pool, const dav_repos_db *d,
+                                       long principal_id,
+                                       const char *acl_priv,
+                                       const char *children_query)
+{
+    apr_array_header_t *groups;
+
+    /* no groups, rather than failing the listing */
+    if (dbms_get_principal_groups(pool, d, principal_id, &groups)) {
+        groups = apr_array_make(pool, 1, sizeof(long));
+        APR_ARRAY_PUSH(groups, long) = principal_id;
+    }
+
+    return apr_psprintf
+      (pool,
+       "acl_membership(group_id) AS ("
+       " SELECT unnest(CAST('%s' AS BIGINT[]))"
+       "), "
+       "acl_privs(id) AS ("
+       " SELECT par_priv.id"
+       " FROM acl_privileges par_priv"
+       " INNER JOIN acl_privileges chi_priv"
+       " ON par_priv.lft <= chi_priv.lft"
+       " AND par_priv.rgt >= chi_priv.rgt"
+       " WHERE chi_priv.name = '%s'"
+       "), "
+       "acl_inherited(parent_path, grantdeny) AS ("
+       " SELECT DISTINCT ON (parents.parent_path)"
+       "  parents.parent_path, aces.grantdeny"
+       " FROM (SELECT DISTINCT"
+       "        chi_res.path[1 : array_upper(chi_res.path, 1) - 1]"
+       "        AS parent_path"
+       "       FROM acl_inheritance chi_res"
+       "       WHERE chi_res.resource_id IN (%s)) parents"
+       " INNER JOIN acl_inheritance par_res"
+       " ON par_res.resource_id ="
+       "   ANY(parents.parent_path)"
+       " INNER JOIN aces ON aces.resource_id = par_res.resource_id"
+       " INNER JOIN dav_aces_privileges ap ON aces.id = ap.ace_id"
+       " INNER JOIN acl_privs ON ap.privilege_id = acl_privs.id"
+       " INNER JOIN acl_membership"
+       " ON aces.principal_id = acl_membership.group_id"
+       " ORDER BY parents.parent_path, array_upper(par_res.path, 1) DESC,"
+       "  aces.protected DESC, aces.id"
+       ")", dbms_principal_groups_array(pool, groups), acl_priv,
+       children_query);
+}
+
+/* grantdeny of the ACE deciding acl_priv on child_binds.resource_id: its
+ * own ACEs come first, then those it inherits; see dbms_child_acl_ctes */
+static const char dbms_child_grantdeny_exp[] =
+  "COALESCE("
+  "(SELECT aces.grantdeny"
+  " FROM aces"
+  " INNER JOIN dav_aces_privileges ap ON aces.id = ap.ace_id"
+  " INNER JOIN acl_privs ON ap.privilege_id = acl_privs.id"
+  " INNER JOIN acl_membership"
+  " ON aces.principal_id = acl_membership.group_id"
+  " WHERE aces.resource_id = child_binds.resource_id"
+  " AND EXISTS (SELECT 1 FROM acl_inheritance"
+  "             WHERE resource_id = child_binds.resource_id)"
+  " ORDER BY aces.protected DESC, aces.id"
+  " LIMIT 1), "
+  "(SELECT acl_inherited.grantdeny"
+  " FROM acl_inheritance chi_res"
+  " INNER JOIN acl_inherited"
+  " ON acl_inherited.parent_path ="
+  "   chi_res.path[1 : array_upper(chi_res.path, 1) - 1]"
+  " WHERE chi_res.resource_id = child_binds.resource_id)"
+  ") AS grantdeny";
+
+/* the DAV: properties that need no more than the resources table, or
+ * only some of the other tables of a children query */
+static const struct {
+    const char *name;
+    int columns;
+} dbms_child_prop_columns[] = {
+    { "resourcetype", 0 },
+    { "displayname", 0 },
+    { "creationdate", 0 },
+    { "getlastmodified", 0 },
+    { "getcontentlanguage", 0 },
+    { "resource-id", 0 },
+    { "lockdiscovery", 0 },
+    { "supportedlock", 0 },
+    { "getcontentlength", DBMS_CHILD_MEDIA },
+    { "getcontenttype", DBMS_CHILD_MEDIA },
+    { "getetag", DBMS_CHILD_MEDIA },
+    { NULL, 0 }
+};
+
+int dbms_child_columns(const apr_array_header_t *names)
+{
+    int i, j, columns = 0;
+
+    if (names == NULL)
+        return DBMS_CHILD_ALL;
+
+    for (i = 0; i < names->nelts; i++) {
+        const dav_prop_name *name = &APR_ARRAY_IDX(names, i, dav_prop_name);
+
+        /* dead properties are loaded apart */
+        if (!dav_get_liveprop_ns_index(name->ns))
+            continue;
+
+        if (strcmp(name->ns, "DAV:"))
+            return DBMS_CHILD_ALL;
+
+        for (j = 0; dbms_child_prop_columns[j].name; j++)
+            if (!strcmp(name->name, dbms_child_prop_columns[j].name))
+                break;
+        if (dbms_child_prop_columns[j].name == NULL)
+            return DBMS_CHILD_ALL;
+        columns |= dbms_child_prop_columns[j].columns;
+    }
+
+    return columns;
+}
+
+/* fills res in from columns 0 to 25 of a row of a children query */
+static void dbms_decode_child(apr_pool_t *pool, dav_repos_resource *res,
+                              char **dbrow)
+{
+    res->bind_id = atoi(dbrow[21]);
+
+    res->serialno = atol(dbrow[0]);
+
+    res->created_at =
+      (dbrow[1] == NULL) ? NULL : apr_pstrdup(pool, dbrow[1]);
+
+    res->displayname =
+      (dbrow[24] == NULL) ? apr_pstrdup(pool, dbrow[2]) : apr_pstrdup(pool, dbrow[24]);
+
+    res->updated_at =
+      (dbrow[3] == NULL) ? NULL : apr_pstrdup(pool, dbrow[3]);
+
+    res->getcontentlanguage =
+      (dbrow[4] == NULL) ? NULL : apr_pstrdup(pool, dbrow[4]);
+
+    res->owner_id = atoi(dbrow[5]);
+
+    res->comment =
+      (dbrow[6] == NULL) ? NULL : apr_pstrdup(pool, dbrow[6]);
+
+    res->creator_id = atoi(dbrow[7]);
+
+    res->resourcetype = dav_repos_get_type_id(dbrow[8]);
+
+    if (res->resourcetype == dav_repos_COLLECTION ||
+        res->resourcetype == dav_repos_VERSIONED_COLLECTION) {
+        res->getcontenttype = apr_pstrdup(pool, DIR_MAGIC_TYPE);
+    }
+    if (res->resourcetype == dav_repos_RESOURCE ||
+        res->resourcetype == dav_repos_VERSION ||
+        res->resourcetype == dav_repos_VERSIONED) {
+
+        res->getcontentlength = atoi(dbrow[9]);
+        res->getcontenttype =
+          (dbrow[10] == NULL) ? NULL : apr_pstrdup(pool,
+                                                   dbrow[10]);
+        res->sha1str =
+          (dbrow[11] == NULL) ? NULL : apr_pstrdup(pool,
+                                                   dbrow[11]);
+    }
+
+
+    if (res->resourcetype == dav_repos_VERSIONED || 
+        res->resourcetype == dav_repos_VERSIONED_COLLECTION){
+        char *checked_state = apr_pstrdup(pool, dbrow[12]);
+        int checked_version = atoi(dbrow[13]);
+        /** TODO: Use a single flag for checkin & checkout */
+        switch (checked_state[0]) {
+        case 'I':
+            res->checked_state = DAV_RESOURCE_CHECKED_IN;
+            res->vr_num = checked_version;
+            break;
+        case 'O':
+            res->checked_state = DAV_RESOURCE_CHECKED_OUT;
+            res->vr_num = checked_version;
+            break;
+        }
+        res->vhr_id = atoi(dbrow[15]);
+        res->autoversion_type = atoi(dbrow[18]);
+        res->checkin_on_unlock = atoi(dbrow[22]);
+    }
+    
+    if (res->resourcetype == dav_repos_VERSION ||
+        res->resourcetype == dav_repos_COLLECTION_VERSION) {
+        int checked_id;
+        res->vcr_id = atoi(dbrow[16]);
+        if (dbrow[17]) {
+            checked_id = atoi(dbrow[17]);
+            res->version = atol(dbrow[20]);
+            if (res->serialno == checked_id)
+                res->lastversion = 1;
+        }
+    }
+
+    res->uuid = apr_pstrdup(pool, dbrow[14]);
+    res->creator_displayname =
+      apr_pstrdup(pool, dbrow[19]);
+
+    res->limebar_state = apr_pstrdup(pool, dbrow[25]);
+
+    res->p = pool;
+}
+
 dav_error *dbms_get_collection_resource(const dav_repos_db *d,
                                         dav_repos_resource *db_r,
                                         dav_repos_resource *db_r_tail,
@@ -755,13 +1297,13 @@ dav_error *dbms_get_collection_resource(const dav_repos_db *d,
                                         dav_repos_resource **plink_tail,
                                         int *num_items)
 {
-    apr_pool_t *pool = db_r->p;
+    apr_pool_t *pool = db_r->p, *row_pool;
     char **dbrow;
     struct dav_repos_resource *presult_link_tail = NULL;
     struct dav_repos_resource *pnew_link_item = NULL;
     dav_repos_resource *dummy_head = NULL;
     dav_repos_query *q = NULL;
-    int num_children = 0, results_count = 0;
+    int num_children = 0, ierrno;
     request_rec *r = db_r->resource->info->rec;
     const dav_hooks_acl *acl_hooks = dav_get_acl_hooks(r);
     const char *query_str;
@@ -805,6 +1347,7 @@ dav_error *dbms_get_collection_resource(const dav_repos_db *d,
         /*Create the search command */
         query_str = apr_psprintf
           (pool,
+           "WITH %s "
            "SELECT resources.id, created_at, child_binds.name,"
            " %s, contentlanguage, owner_id, comment,"
            " creator_id, type, size, mimetype, sha1, vcrs.checked_state,"
@@ -812,44 +1355,7 @@ dav_error *dbms_get_collection_resource(const dav_repos_db *d,
            " vr_vcr.checked_id, vcrs.version_type, principals.name,"
            " versions.number, child_binds.id, vcrs.checkin_on_unlock,"
            " child_binds.collection_id, displayname, limebar_state, "
-           " ("
-           "SELECT aces.grantdeny"
-           " FROM aces"
-           " INNER JOIN dav_aces_privileges ap "
-           "ON aces.id = ap.ace_id"
-           " INNER JOIN ("
-           "(SELECT transitive_group_id AS group_id"
-           " FROM transitive_group_members"
-           " WHERE transitive_member_id=%ld) "
-           "UNION   (SELECT %ld)"
-           ") membership "
-           "ON aces.principal_id = membership.group_id"
-           " INNER JOIN ("
-           "SELECT par_priv.id AS par_priv_id"
-           " FROM acl_privileges par_priv"
-           " INNER JOIN acl_privileges chi_priv "
-           "ON par_priv.lft <= chi_priv.lft"
-           " AND par_priv.rgt >= chi_priv.rgt"
-           " WHERE chi_priv.name = '%s' "
-           ") privs "
-           "ON ap.privilege_id = privs.par_priv_id"
-           " INNER JOIN ("
-
-           "SELECT par_res.resource_id AS resource_id,"
-           " par_res.path AS par_res_path,"
-           " chi_res.resource_id AS resource_tag"
-           " FROM acl_inheritance AS par_res"
-           " INNER JOIN acl_inheritance AS chi_res"
-           " ON par_res.resource_id = "
-           "   ANY(CAST(string_to_array(chi_res.path, ',') "
-           "     AS INTEGER[])) "
-           ") inherited_res "
-
-           "ON aces.resource_id = inherited_res.resource_id"
-           " WHERE inherited_res.resource_tag = child_binds.resource_id "
-           "ORDER BY CHAR_LENGTH(par_res_path) DESC, protected DESC, id "
-           "LIMIT 1"
-           ") AS grantdeny"
+           " %s"
            " FROM binds child_binds"
            " LEFT JOIN resources ON resources.id = child_binds.resource_id"
            " LEFT JOIN media ON media.resource_id = child_binds.resource_id"
@@ -862,7 +1368,11 @@ dav_error *dbms_get_collection_resource(const dav_repos_db *d,
            " LEFT JOIN vcrs AS vr_vcr "
            "ON vr_vcr.checked_id = versions.resource_id"
            " WHERE child_binds.collection_id IN (%s)",
-           updated_at_exp, principal_id, principal_id, acl_priv, col_ids_str);
+           dbms_child_acl_ctes
+             (pool, d, principal_id, acl_priv,
+              apr_psprintf(pool, "SELECT resource_id FROM binds"
+                           " WHERE collection_id IN (%s)", col_ids_str)),
+           updated_at_exp, dbms_child_grantdeny_exp, col_ids_str);
     } else {
         /*Create the search command */
         query_str = apr_psprintf
@@ -892,6 +1402,7 @@ dav_error *dbms_get_collection_resource(const dav_repos_db *d,
            updated_at_exp, col_ids_str);
     }
     q = dbms_prepare(pool, d->db, query_str);
+    dbms_set_fetch_size(q, d->fetch_size);
     if (dbms_execute(q)) {
         db_error_message(db_r->p, d->db, "dbms_execute error");
         dbms_query_destroy(q);
@@ -903,12 +1414,15 @@ dav_error *dbms_get_collection_resource(const dav_repos_db *d,
     presult_link_tail = dummy_head;
     presult_link_tail->next = NULL;
     presult_link_tail->pr = NULL;
-    
-    results_count = dbms_results_count(q);
-    while (num_children < results_count) {
+
+    /* everything kept is copied out of the row, so it can be freed as
+     * soon as it has been processed */
+    apr_pool_create(&row_pool, pool);
+    while ((ierrno = dbms_next(q)) == 1) {
         const char *parent_uri;
-        
-        dbrow = dbms_fetch_row_num(d->db, q, pool, num_children);
+
+        apr_pool_clear(row_pool);
+        dbrow = dbms_get_row(q, row_pool);
         num_children++;
 
         if (acl_hooks && acl_priv && dbrow[26][0] != 'G')
@@ -934,104 +1448,409 @@ dav_error *dbms_get_collection_resource(const dav_repos_db *d,
             presult_link_tail->uri = apr_psprintf(db_r->p, "/%s", dbrow[2]);
         }
         
-        presult_link_tail->bind_id = atoi(dbrow[21]);
+        dbms_decode_child(db_r->p, presult_link_tail, dbrow);
 
-        presult_link_tail->serialno = atol(dbrow[0]);
+        presult_link_tail->next = NULL;
+        presult_link_tail->pr = NULL;
+    }               /*End of while (( dbrow = ... )) */
 
-        presult_link_tail->created_at =
-          (dbrow[1] == NULL) ? NULL : apr_pstrdup(db_r->p, dbrow[1]);
+    apr_pool_destroy(row_pool);
+    dbms_query_destroy(q);
 
-        presult_link_tail->displayname =
-          (dbrow[24] == NULL) ? apr_pstrdup(db_r->p, dbrow[2]) : apr_pstrdup(db_r->p, dbrow[24]);
+    if (ierrno < 0)
+        return dav_new_error(pool, HTTP_INTERNAL_SERVER_ERROR, 0,
+                             "Can't get collection resource");
 
-        presult_link_tail->updated_at =
-          (dbrow[3] == NULL) ? NULL : apr_pstrdup(db_r->p, dbrow[3]);
+    if (plink_head)
+        *plink_head = dummy_head->next;
+    if (plink_tail)
+        *plink_tail = dummy_head->next?presult_link_tail:NULL;
+    if (num_items)
+        *num_items = num_children;
 
-        presult_link_tail->getcontentlanguage =
-          (dbrow[4] == NULL) ? NULL : apr_pstrdup(db_r->p, dbrow[4]);
+    return NULL;
+}               /*End of dbms_get_collection_resource */
 
-        presult_link_tail->owner_id = atoi(dbrow[5]);
+/* resources handed to a dbms_child_fn between two clearings of their pool */
+#define DBMS_STREAM_BATCH 100
 
-        presult_link_tail->comment =
-          (dbrow[6] == NULL) ? NULL : apr_pstrdup(db_r->p, dbrow[6]);
+/**
+ * Reads the resources below db_r down to depth, either into a list or, when
+ * fn is set, handing them to fn a batch at a time from a pool cleared
+ * after each batch. With a page, depth must be 1 and the children are read
+ * in the order of their names, from the first one after page->after on
+ */
+static dav_error *dbms_read_descendants(const dav_repos_db *d,
+                                        dav_repos_resource *db_r, int depth,
+                                        const char *acl_priv, int columns,
+                                        dbms_children_page *page,
+                                        dbms_children_fn fn, void *baton,
+                                        dav_repos_resource **plink_head,
+                                        dav_repos_resource **plink_tail,
+                                        int *num_items)
+{
+    apr_pool_t *pool = db_r->p, *row_pool, *batch_pool = NULL;
+    char **dbrow;
+    dav_repos_resource *dummy_head, *tail, *res;
+    dav_repos_query *q = NULL;
+    int num_children = 0, batch = 0, ierrno;
+    request_rec *r = db_r->resource->info->rec;
+    const dav_hooks_acl *acl_hooks = dav_get_acl_hooks(r);
+    int check_acl = acl_hooks && acl_priv;
+    const char *query_str, *seed_updated_at, *child_binds;
+    const char *page_order, *last_name = NULL;
+    const char *media_cols, *creator_col, *version_cols[8], *joins = "";
+    apr_hash_t *retr_rs;   /* serialno -> last resource retrieved with it */
+    apr_hash_t *expanded;  /* paths below db_r of the collections gone into */
+    const char *root_uri =
+      (db_r->uri && strcmp(db_r->uri, "/")) ? db_r->uri : "";
+    dav_error *err = NULL;
 
-        presult_link_tail->creator_id = atoi(dbrow[7]);
+    TRACE();
 
-        presult_link_tail->resourcetype = dav_repos_get_type_id(dbrow[8]);
+    /* one more child than the page holds tells whether more follow; the
+     * (collection_id, name) key hands them out in order */
+    if (page) {
+        page->next = NULL;
+        seed_updated_at = db_r->updated_at
+          ? apr_psprintf(pool, "greatest('%s', updated_at)", db_r->updated_at)
+          : "updated_at";
+        child_binds = apr_psprintf
+          (pool,
+           "child_binds(id, resource_id, collection_id, name, updated_at,"
+           "            depth, path, expanded) AS ("
+           "    SELECT id, resource_id, collection_id, name, %s, 1,"
+           "           CAST(name AS TEXT), TRUE"
+           "    FROM binds WHERE collection_id = %ld%s"
+           "    ORDER BY name LIMIT %d)",
+           seed_updated_at, db_r->serialno,
+           page->after ? " AND name > ?" : "", page->limit + 1);
+        page_order = ", child_binds.name";
+    } else {
+        /* every resource is gone into once, through the bind that comes
+         * first in its level; see descendant_binds */
+        seed_updated_at = db_r->updated_at
+          ? apr_psprintf(pool, "CAST('%s' AS TIMESTAMP)", db_r->updated_at)
+          : "NULL";
+        child_binds = apr_psprintf
+          (pool, "child_binds AS (SELECT * FROM descendant_binds(%ld, %s, %s))",
+           db_r->serialno, seed_updated_at,
+           depth == DAV_INFINITY ? "NULL" : apr_itoa(pool, depth));
+        page_order = ", child_binds.expanded DESC";
+    }
 
-        if (presult_link_tail->resourcetype == dav_repos_COLLECTION ||
-            presult_link_tail->resourcetype == dav_repos_VERSIONED_COLLECTION) {
-            presult_link_tail->getcontenttype = apr_pstrdup(db_r->p, DIR_MAGIC_TYPE);
-        }
-        if (presult_link_tail->resourcetype == dav_repos_RESOURCE ||
-            presult_link_tail->resourcetype == dav_repos_VERSION ||
-            presult_link_tail->resourcetype == dav_repos_VERSIONED) {
-
-            presult_link_tail->getcontentlength = atoi(dbrow[9]);
-            presult_link_tail->getcontenttype =
-              (dbrow[10] == NULL) ? NULL : apr_pstrdup(db_r->p,
-                                                       dbrow[10]);
-            presult_link_tail->sha1str =
-              (dbrow[11] == NULL) ? NULL : apr_pstrdup(db_r->p,
-                                                       dbrow[11]);
-        }
+    /* columns of the tables left out are selected as constants that
+     * dbms_decode_child takes for missing data */
+    if (columns & DBMS_CHILD_MEDIA) {
+        media_cols = "size, mimetype, sha1";
+        joins = "      LEFT JOIN media ON resources.id = media.resource_id ";
+    } else
+        media_cols = "-1, NULL, NULL";
 
+    if (columns & DBMS_CHILD_CREATOR) {
+        creator_col = "principals.name";
+        joins = apr_pstrcat
+          (pool, joins,
+           "      LEFT JOIN principals "
+           "          ON resources.creator_id = principals.resource_id ", NULL);
+    } else
+        creator_col = "NULL";
+
+    if (columns & DBMS_CHILD_VERSIONS) {
+        version_cols[0] = "vcrs.checked_state";
+        version_cols[1] = "checked_version.number";
+        version_cols[2] = "vcrs.vhr_id";
+        version_cols[3] = "versions.vcr_id";
+        version_cols[4] = "vr_vcr.checked_id";
+        version_cols[5] = "vcrs.version_type";
+        version_cols[6] = "versions.number";
+        version_cols[7] = "vcrs.checkin_on_unlock";
+        joins = apr_pstrcat
+          (pool, joins,
+           "      LEFT JOIN vcrs ON resources.id = vcrs.resource_id "
+           "      LEFT JOIN versions AS checked_version "
+           "          ON checked_version.resource_id = vcrs.checked_id "
+           "      LEFT JOIN versions ON versions.resource_id = resources.id "
+           "      LEFT JOIN vcrs AS vr_vcr "
+           "          ON vr_vcr.checked_id = versions.resource_id ", NULL);
+    } else {
+        version_cols[0] = "''";
+        version_cols[1] = version_cols[2] = version_cols[3] = "0";
+        version_cols[4] = "NULL";
+        version_cols[5] = version_cols[6] = version_cols[7] = "0";
+    }
 
-        if (presult_link_tail->resourcetype == dav_repos_VERSIONED || 
-            presult_link_tail->resourcetype == dav_repos_VERSIONED_COLLECTION){
-            char *checked_state = apr_pstrdup(db_r->p, dbrow[12]);
-            int checked_version = atoi(dbrow[13]);
-            /** TODO: Use a single flag for checkin & checkout */
-            switch (checked_state[0]) {
-            case 'I':
-                presult_link_tail->checked_state = DAV_RESOURCE_CHECKED_IN;
-                presult_link_tail->vr_num = checked_version;
-                break;
-            case 'O':
-                presult_link_tail->checked_state = DAV_RESOURCE_CHECKED_OUT;
-                presult_link_tail->vr_num = checked_version;
+    /* every path down from db_r, along with the greatest updated_at of
+     * the binds on it */
+    query_str = apr_psprintf
+      (pool,
+       "WITH %s%s%s "
+       "SELECT resources.id, "
+       "       created_at, child_binds.name, "
+       "       greatest(lastmodified, child_binds.updated_at), "
+       "       contentlanguage, owner_id, comment, "
+       "       creator_id, type, %s, %s, "
+       "       %s, uuid, %s, "
+       "       %s, %s, %s, "
+       "       %s, %s, child_binds.id, "
+       "       %s, child_binds.collection_id, displayname, limebar_state, "
+       "       child_binds.path%s%s "
+       "FROM child_binds "
+       "      INNER JOIN resources ON resources.id = child_binds.resource_id "
+       "%s"
+       "ORDER BY child_binds.depth%s",
+       child_binds, check_acl ? ", " : "",
+       check_acl ? dbms_child_acl_ctes
+         (pool, d, dav_repos_get_principal_id(dav_principal_make_from_request(r)),
+          acl_priv, "SELECT resource_id FROM child_binds") : "",
+       media_cols, version_cols[0], version_cols[1], version_cols[2],
+       version_cols[3], version_cols[4], version_cols[5],
+       creator_col, version_cols[6], version_cols[7],
+       check_acl ? ", " : "", check_acl ? dbms_child_grantdeny_exp : "",
+       joins, page_order);
+
+    q = dbms_prepare(pool, d->db, query_str);
+    if (page && page->after)
+        dbms_set_string(q, 1, page->after);
+    dbms_set_fetch_size(q, d->fetch_size);
+    if (dbms_execute(q)) {
+        db_error_message(db_r->p, d->db, "dbms_execute error");
+        dbms_query_destroy(q);
+        return dav_new_error(pool, HTTP_INTERNAL_SERVER_ERROR, 0,
+                             "Can't get descendants");
+    }
+
+    dummy_head = apr_pcalloc(pool, sizeof(*dummy_head));
+    tail = dummy_head;
+
+    retr_rs = apr_hash_make(pool);
+    apr_hash_set(retr_rs, &(db_r->serialno), sizeof(long), db_r);
+    expanded = apr_hash_make(pool);
+
+    apr_pool_create(&row_pool, pool);
+    if (fn)
+        apr_pool_create(&batch_pool, pool);
+    while ((ierrno = dbms_next(q)) == 1) {
+        char *path, *name;
+        long *serialno;
+
+        apr_pool_clear(row_pool);
+        dbrow = dbms_get_row(q, row_pool);
+
+        if (page) {
+            if (num_children == page->limit) {
+                page->next = last_name;
                 break;
             }
-            presult_link_tail->vhr_id = atoi(dbrow[15]);
-            presult_link_tail->autoversion_type = atoi(dbrow[18]);
-            presult_link_tail->checkin_on_unlock = atoi(dbrow[22]);
+            if (num_children == page->limit - 1)
+                last_name = apr_pstrdup(pool, dbrow[2]);
         }
-    
-        if (presult_link_tail->resourcetype == dav_repos_VERSION ||
-            presult_link_tail->resourcetype == dav_repos_COLLECTION_VERSION) {
-            int checked_id;
-            presult_link_tail->vcr_id = atoi(dbrow[16]);
-            if (dbrow[17]) {
-                checked_id = atoi(dbrow[17]);
-                presult_link_tail->version = atol(dbrow[20]);
-                if (presult_link_tail->serialno == checked_id)
-                    presult_link_tail->lastversion = 1;
-            }
+
+        /* the first resource met for an id is the one the query went
+         * into; children of resources left out are dropped */
+        path = dbrow[26];
+        if ((name = strrchr(path, '/'))) {
+            *name = '\0';
+            if (!apr_hash_get(expanded, path, APR_HASH_KEY_STRING))
+                continue;
+            *name = '/';
         }
+        num_children++;
+
+        if (check_acl && dbrow[27][0] != 'G')
+            continue;
 
-        presult_link_tail->uuid = apr_pstrdup(db_r->p, dbrow[14]);
-        presult_link_tail->creator_displayname =
-          apr_pstrdup(db_r->p, dbrow[19]);
+        if (fn) {
+            dav_resource *resource;
 
-        presult_link_tail->limebar_state = apr_pstrdup(db_r->p, dbrow[25]);
+            err = dav_repos_new_resource_in_pool(r, batch_pool,
+                                                 db_r->root_path, &resource);
+            if (err)
+                break;
+            res = resource->info->db_r;
+            dbms_decode_child(batch_pool, res, dbrow);
+        } else {
+            res = NULL;
+            sabridge_new_dbr_from_dbr(db_r, &res);
+            dbms_decode_child(db_r->p, res, dbrow);
+        }
+        tail->next = res;
+        tail = res;
+
+        res->parent_id = atol(dbrow[23]);
+        res->uri = apr_pstrcat(res->p, root_uri, "/", path, NULL);
+        res->next = NULL;
+        res->pr = NULL;
+
+        /* resources handed to fn don't outlive their batch, so only
+         * whether the id was met before is kept for them */
+        res->bind = apr_hash_get(retr_rs, &(res->serialno), sizeof(long));
+        if (fn) {
+            if (!res->bind) {
+                serialno = apr_pmemdup(pool, &res->serialno, sizeof(long));
+                apr_hash_set(retr_rs, serialno, sizeof(long), db_r);
+            }
+        } else
+            apr_hash_set(retr_rs, &(res->serialno), sizeof(long), res);
 
-        presult_link_tail->p = pool;
+        if (!res->bind && (res->resourcetype == dav_repos_COLLECTION
+                           || res->resourcetype == dav_repos_VERSIONED_COLLECTION))
+            apr_hash_set(expanded, apr_pstrdup(pool, path),
+                         APR_HASH_KEY_STRING, pool);
 
-        presult_link_tail->next = NULL;
-        presult_link_tail->pr = NULL;
-    }               /*End of while (( dbrow = ... )) */
+        if (fn && ++batch == DBMS_STREAM_BATCH) {
+            if ((err = fn(baton, dummy_head->next)))
+                break;
+            apr_pool_clear(batch_pool);
+            dummy_head->next = NULL;
+            tail = dummy_head;
+            batch = 0;
+        }
+    }
 
+    if (fn && !err && ierrno >= 0 && dummy_head->next)
+        err = fn(baton, dummy_head->next);
+
+    apr_pool_destroy(row_pool);
+    if (batch_pool)
+        apr_pool_destroy(batch_pool);
     dbms_query_destroy(q);
 
+    if (err)
+        return err;
+    if (ierrno < 0)
+        return dav_new_error(pool, HTTP_INTERNAL_SERVER_ERROR, 0,
+                             "Can't get descendants");
+
+    if (fn)
+        return NULL;
+
     if (plink_head)
         *plink_head = dummy_head->next;
     if (plink_tail)
-        *plink_tail = dummy_head->next?presult_link_tail:NULL;
+        *plink_tail = dummy_head->next ? tail : NULL;
     if (num_items)
         *num_items = num_children;
 
     return NULL;
-}               /*End of dbms_get_collection_resource */
+}
+
+dav_error *dbms_get_descendants(const dav_repos_db *d,
+                                dav_repos_resource *db_r,
+                                const char *acl_priv,
+                                dav_repos_resource **plink_head,
+                                dav_repos_resource **plink_tail,
+                                int *num_items)
+{
+    return dbms_read_descendants(d, db_r, DAV_INFINITY, acl_priv,
+                                 DBMS_CHILD_ALL, NULL, NULL, NULL,
+                                 plink_head, plink_tail, num_items);
+}
+
+dav_error *dbms_stream_descendants(const dav_repos_db *d,
+                                   dav_repos_resource *db_r, int depth,
+                                   const char *acl_priv, int columns,
+                                   dbms_children_page *page,
+                                   dbms_children_fn fn, void *baton)
+{
+    return dbms_read_descendants(d, db_r, depth, acl_priv, columns, page,
+                                 fn, baton, NULL, NULL, NULL);
+}
+
+dav_error *dbms_get_child_names(const dav_repos_db *d,
+                                dav_repos_resource *db_r,
+                                const char *acl_priv,
+                                dbms_children_page *page,
+                                dbms_child_name_fn fn, void *baton)
+{
+    apr_pool_t *pool = db_r->p, *row_pool;
+    request_rec *r = db_r->resource->info->rec;
+    int check_acl = dav_get_acl_hooks(r) && acl_priv;
+    const char *after = "", *limit = "", *children;
+    dav_repos_query *q;
+    char **dbrow;
+    int ierrno, num_children = 0;
+    const char *last_name = NULL;
+    dav_error *err = NULL;
+
+    TRACE();
+
+    if (page) {
+        page->next = NULL;
+        if (page->after)
+            after = " AND name > ?";
+        limit = apr_psprintf(pool, " LIMIT %d", page->limit + 1);
+    }
+
+    /* the ACEs are only worked out for the children of the page */
+    children = apr_psprintf(pool, "SELECT resource_id FROM binds"
+                            " WHERE collection_id = %ld%s"
+                            " ORDER BY name%s",
+                            db_r->serialno, after, limit);
+
+    q = dbms_prepare
+      (pool, d->db,
+       apr_psprintf(pool,
+                    "%s%s "
+                    "SELECT child_binds.name, resources.type%s%s"
+                    " FROM binds child_binds"
+                    " INNER JOIN resources"
+                    " ON resources.id = child_binds.resource_id"
+                    " WHERE child_binds.collection_id = %ld%s"
+                    " ORDER BY child_binds.name%s",
+                    check_acl ? "WITH " : "",
+                    check_acl ? dbms_child_acl_ctes
+                      (pool, d, dav_repos_get_principal_id
+                         (dav_principal_make_from_request(r)),
+                       acl_priv, children) : "",
+                    check_acl ? ", " : "",
+                    check_acl ? dbms_child_grantdeny_exp : "",
+                    db_r->serialno, *after ? " AND child_binds.name > ?" : "",
+                    limit));
+    if (*after) {
+        dbms_set_string(q, 1, page->after);
+        if (check_acl)
+            dbms_set_string(q, 2, page->after);
+    }
+    dbms_set_fetch_size(q, d->fetch_size);
+    if (dbms_execute(q)) {
+        dbms_query_destroy(q);
+        return dav_new_error(pool, HTTP_INTERNAL_SERVER_ERROR, 0,
+                             "Can't get the names of the children");
+    }
+
+    apr_pool_create(&row_pool, pool);
+    while ((ierrno = dbms_next(q)) == 1) {
+        apr_pool_clear(row_pool);
+        dbrow = dbms_get_row(q, row_pool);
+
+        if (page) {
+            if (num_children == page->limit) {
+                page->next = last_name;
+                break;
+            }
+            if (num_children == page->limit - 1)
+                last_name = apr_pstrdup(pool, dbrow[0]);
+        }
+        num_children++;
+
+        if (check_acl && dbrow[2][0] != 'G')
+            continue;
+
+        if ((err = fn(baton, dbrow[0], dav_repos_get_type_id(dbrow[1]))))
+            break;
+    }
+
+    apr_pool_destroy(row_pool);
+    dbms_query_destroy(q);
+
+    if (err)
+        return err;
+    if (ierrno < 0)
+        return dav_new_error(pool, HTTP_INTERNAL_SERVER_ERROR, 0,
+                             "Can't get the names of the children");
+    return NULL;
+}
 
 dav_error *dbms_copy_media_props(const dav_repos_db *d,
                                  const dav_repos_resource *r_src,
@@ -107,6 +107,9 @@ struct dav_repos_resource {
     /** Creation/Modification Dates in DATETIME string format */
     const char *created_at;	
     const char *updated_at;
+
+    /** resources.lastmodified, which updated_at already takes into account */
+    const char *lastmodified;
     
     /** DAV:displayname for the resource */
     const char *displayname;
@@ -138,6 +141,9 @@ struct dav_repos_resource {
     /** for dead property data */
     dav_repos_property *pr;	
 
+    /** 1 once pr holds every dead property that is going to be asked for */
+    int pr_filled;
+
     /** use for output value */
     apr_hash_t *pr_hash;	
     
@@ -275,6 +281,33 @@ void db_error_message(apr_pool_t * pool, const dav_repos_dbms * db,
 int dbms_opendb(dav_repos_db *d, apr_pool_t *p, request_rec *r,
                 const char *db_driver, const char *db_params);
 
+/**
+ * Connects to the read replica for the length of a request
+ * @param d DB connection struct, with the replica set up
+ * @param p The pool to allocate from
+ * @param r The request
+ * @return 0 indicating success
+ */
+int dbms_opendb_replica(dav_repos_db *d, apr_pool_t *p, request_rec *r);
+
+/**
+ * Get the id of the current transaction, assigning one if need be
+ * @param pool The pool to allocate from
+ * @param d DB connection struct
+ * @return the transaction id, 0 on error
+ */
+long dbms_get_current_txid(apr_pool_t *pool, const dav_repos_db *d);
+
+/**
+ * Tells whether the effects of a transaction are visible to new snapshots
+ * on this connection, i.e. whether a replica has replayed it
+ * @param pool The pool to allocate from
+ * @param d DB connection struct
+ * @param txid The transaction id
+ * @return 1 if visible, 0 if not or on error
+ */
+int dbms_txid_visible(apr_pool_t *pool, const dav_repos_db *d, long txid);
+
 /**
  * Disconnect from the database server
  * @param s The server record
@@ -291,6 +324,16 @@ void dbms_closedb(dav_repos_db * d);
  */
 dav_error *dbms_get_resource(const dav_repos_db *d, dav_repos_resource *r);
 
+/**
+ * Get the properties of the resource along with its collection, media,
+ * redirect and DeltaV properties, in a single query
+ * @param d The DB connection struct
+ * @param r The resource handle
+ * @return NULL on success, dav_error otherwise
+ */
+dav_error *dbms_get_resource_full(const dav_repos_db *d,
+                                  dav_repos_resource *r);
+
 /**
  * Insert media props of a given resource
  * @param d The DB connection struct
@@ -424,6 +467,20 @@ dav_error *dbms_set_dead_property(const dav_repos_db * d,
  */
 dav_error *dbms_fill_dead_property(const dav_repos_db * d,
 	                           dav_repos_resource * db_r);
+
+/**
+ * Fill in the dead properties of a list of resources with a single query
+ * @param d DB connection struct
+ * @param pool The pool for the query
+ * @param resources The resources, linked through their next member
+ * @param names The dav_prop_name of the properties asked for, NULL to get
+ * all of them
+ * @return NULL on success, error otherwise
+ */
+dav_error *dbms_fill_dead_properties(const dav_repos_db *d,
+                                     apr_pool_t *pool,
+                                     dav_repos_resource *resources,
+                                     const apr_array_header_t *names);
 /**
  * Retrieve all children of a set of collections. The collections are
  * passed as linked list joined by dav_repos_resource's next member.
@@ -451,6 +508,98 @@ dav_error *dbms_get_collection_resource(const dav_repos_db * d,
                                         dav_repos_resource **plink_tail,
                                         int *num_items);
 
+/**
+ * Get every resource below a collection with a single recursive query, in
+ * the order sabridge_get_collection_children would reach them with
+ * depth=Infinity: by depth, and with the bind member of a resource already
+ * retrieved through another path set to that earlier retrieval
+ * @param d DB connection struct
+ * @param db_r The collection
+ * @param acl_priv The ACL privilege to filter against
+ * @param plink_head The head pointer of the linked-list of resultant resources
+ * @param plink_tail The tail pointer of the linked-list of resultant resources
+ * @param num_items The number of resources in the response
+ * @return NULL for success, dav_error otherwise
+ */
+dav_error *dbms_get_descendants(const dav_repos_db *d,
+                                dav_repos_resource *db_r,
+                                const char *acl_priv,
+                                dav_repos_resource **plink_head,
+                                dav_repos_resource **plink_tail,
+                                int *num_items);
+
+/* the tables, besides resources and binds, a children query reads */
+#define DBMS_CHILD_MEDIA    0x1
+#define DBMS_CHILD_CREATOR  0x2
+#define DBMS_CHILD_VERSIONS 0x4
+#define DBMS_CHILD_ALL      0x7
+
+/**
+ * Works out the tables a children query needs to read for the live
+ * properties in names to be right
+ * @param names The dav_prop_name asked for, NULL for all properties
+ * @return The DBMS_CHILD_ flags of the tables to read
+ */
+int dbms_child_columns(const apr_array_header_t *names);
+
+/* a page of the children of a collection, in the order of their names */
+typedef struct {
+    const char *after;  /* the last name of the page before, NULL for the
+                         * first page */
+    int limit;          /* the most children to read */
+    const char *next;   /* set to the last name read when more follow */
+} dbms_children_page;
+
+/* called by dbms_stream_descendants with each batch of resources read,
+ * linked through their next member */
+typedef dav_error *(*dbms_children_fn)(void *baton,
+                                       dav_repos_resource *children);
+
+/**
+ * Like dbms_get_descendants, but reads the resources down to depth from a
+ * cursor and hands them to fn a batch at a time instead of building the
+ * whole list. Each batch is allocated from a pool that is cleared once fn
+ * returns, so fn must not keep any reference to it; the bind member of a
+ * resource already retrieved through another path is set to db_r
+ * @param d DB connection struct
+ * @param db_r The collection
+ * @param depth How far down to go, 1 or DAV_INFINITY
+ * @param acl_priv The ACL privilege to filter against
+ * @param columns The DBMS_CHILD_ flags of the tables to read, the fields
+ * coming from the others are left as if there were no data for them
+ * @param page The page of children to read when depth is 1, NULL for all
+ * @param fn The function to call for each batch
+ * @param baton Passed to fn
+ * @return NULL for success, dav_error otherwise, including those from fn
+ */
+dav_error *dbms_stream_descendants(const dav_repos_db *d,
+                                   dav_repos_resource *db_r, int depth,
+                                   const char *acl_priv, int columns,
+                                   dbms_children_page *page,
+                                   dbms_children_fn fn, void *baton);
+
+/* called by dbms_get_child_names with each child read */
+typedef dav_error *(*dbms_child_name_fn)(void *baton, const char *name,
+                                         int resourcetype);
+
+/**
+ * Reads just the names and types of the children of a collection, in the
+ * order of their names, from a cursor
+ * @param d DB connection struct
+ * @param db_r The collection
+ * @param acl_priv The ACL privilege to filter against, NULL for none
+ * @param page The page of children to read, NULL for all
+ * @param fn The function to call for each child, with a name that does not
+ * outlive the call
+ * @param baton Passed to fn
+ * @return NULL for success, dav_error otherwise, including those from fn
+ */
+dav_error *dbms_get_child_names(const dav_repos_db *d,
+                                dav_repos_resource *db_r,
+                                const char *acl_priv,
+                                dbms_children_page *page,
+                                dbms_child_name_fn fn, void *baton);
+
 /**
  * Copy media props of one resource to another
  * @param d The DB conneciton struct
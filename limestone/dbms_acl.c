@@ -18,7 +18,11 @@
 
 #include "dbms_acl.h"
 #include "bridge.h"     /* for sabridge_reverse_lookup */
+#include "dbms_acl_cache.h"
+#include "dbms_principal.h"
 #include <stdlib.h>
+#include <string.h>
+#include <apr_atomic.h>
 
 #define SUPER_USER_ID   1
 
@@ -186,6 +190,7 @@ int dbms_delete_own_aces(const dav_repos_db * d, dav_repos_resource * r)
     q = dbms_prepare(pool, d->db,
 		     "DELETE FROM aces WHERE resource_id = ? AND protected = 'f'");
     dbms_set_int(q, 1, r->serialno);
+    dbms_acl_cache_invalidate();
     if(dbms_execute(q))
         retVal = HTTP_INTERNAL_SERVER_ERROR;
     dbms_query_destroy(q);
@@ -260,6 +265,7 @@ dav_error *dbms_add_ace(const dav_repos_db * d, dav_repos_resource * r,
         dbms_get_ns_id(d, r, ace_property->ns, &ns_id);
 
     principal_id = dav_repos_get_principal_id(ace_principal);
+    dbms_acl_cache_invalidate();
     
     q = dbms_prepare(pool, d->db,
 		     "INSERT INTO aces(grantdeny, resource_id, principal_id, protected, "
@@ -346,8 +352,7 @@ int dbms_get_acl(const dav_repos_db * d, dav_repos_resource * r)
                         "FROM acl_inheritance AS par_res "
                         "INNER JOIN acl_inheritance AS chi_res "
                         "ON par_res.resource_id = "
-                          "ANY(CAST(string_to_array(chi_res.path, ',') "
-                             "AS INTEGER[])) "
+                          "ANY(chi_res.path) "
                         "WHERE chi_res.resource_id = ? ) inherited_res "
                       "ON aces.resource_id = inherited_res.resource_id "
 
@@ -358,7 +363,7 @@ int dbms_get_acl(const dav_repos_db * d, dav_repos_resource * r)
                      /* non-inherited ACE's first, then inherited ACEs 
                       * in reverse order of inheritance 
                       * ( farthest parent first ) */
-                     "ORDER BY protected DESC, CHAR_LENGTH(par_res_path) DESC, aces.id");
+                     "ORDER BY protected DESC, array_upper(par_res_path, 1) DESC, aces.id");
     dbms_set_int(q, 1, r->serialno);
     dbms_execute(q);
 
@@ -434,13 +439,509 @@ int dbms_get_acl(const dav_repos_db * d, dav_repos_resource * r)
     return 1;
 }
 
-static const char *make_member_query(apr_pool_t *pool, long p_id, int order)
+/*
+ * ACL checks evaluated in the process, from entries holding:
+ *   "p<ns id>:<name>"  the lft and rgt of a privilege, none if unknown
+ *   "r<resource id>"   principal, grant, lft and rgt of every privilege of
+ *                      every ACE applying to the resource, in the order
+ *                      they take precedence
+ * Entries are looked for among those the request loaded, then in the ACL
+ * cache. Requests that cannot see ACL changes of their own making load
+ * what they miss and fill the cache with it; the others only load for
+ * many resources at once, see dbms_acl_prefetch, and keep it to
+ * themselves. What a request loaded is good until the next ACL change,
+ * its own included. Group closures come from the group cache.
+ */
+#define ACL_ACE_VALS 4
+
+/* an entry loaded by the request, kept in its dav_repos_cache */
+typedef struct {
+    apr_uint32_t generation;    /* of the ACL cache, read before loading */
+    int nvals;
+    long *vals;
+} dbms_acl_entry;
+
+/* privileges as bits, privilege i of dbms_acl_layout being bit i */
+typedef apr_uint64_t dbms_acl_mask;
+#define ACL_MAX_PRIVILEGES 64
+
+typedef struct {
+    const char *ns;
+    const char *name;
+    const char *xml;            /* its DAV:privilege element */
+    apr_size_t xml_len;
+    long lft, rgt;
+    dbms_acl_mask mask;         /* its bit and those of the privileges it
+                                 * aggregates */
+} dbms_acl_privilege;
+
+/* the privileges ordered by lft, see dbms_acl_privileges */
+typedef struct {
+    int nprivs;
+    dbms_acl_privilege privs[ACL_MAX_PRIVILEGES];
+} dbms_acl_layout;
+
+static volatile void *acl_layout;
+
+/* the entries loaded by a request, NULL without one */
+static apr_hash_t *dbms_acl_loaded(request_rec *rec)
+{
+    return rec ? sabridge_get_cache(rec)->acl_entries : NULL;
+}
+
+/* may the request fill the ACL cache with what it loads */
+static int dbms_acl_can_fill(const dav_repos_db *db)
+{
+    /* a transaction that may write can see ACL changes of its own, and a
+     * replica may lag behind the generation */
+    return dbms_acl_cache_enabled()
+      && db->acl_generation == dbms_acl_cache_generation()
+      && (!dbms_api_in_transaction(db->db) || dbms_api_read_only(db->db))
+      && !dbms_api_is_replica(db->db);
+}
+
+static long *dbms_acl_lookup(apr_pool_t *pool, const dav_repos_db *db,
+                             apr_hash_t *loaded, const char *key, int *nvals)
+{
+    dbms_acl_entry *entry =
+      loaded ? apr_hash_get(loaded, key, APR_HASH_KEY_STRING) : NULL;
+
+    if (entry && entry->generation == dbms_acl_cache_generation()) {
+        *nvals = entry->nvals;
+        return entry->vals;
+    }
+    return dbms_acl_cache_get(pool, db->acl_generation, key, nvals);
+}
+
+static void dbms_acl_remember(const dav_repos_db *db, apr_hash_t *loaded,
+                              apr_uint32_t generation, const char *key,
+                              const long *vals, int nvals)
+{
+    if (loaded) {
+        apr_pool_t *pool = apr_hash_pool_get(loaded);
+        dbms_acl_entry *entry = apr_palloc(pool, sizeof(*entry));
+
+        entry->generation = generation;
+        entry->nvals = nvals;
+        entry->vals = apr_palloc(pool, nvals * sizeof(long) + 1);
+        memcpy(entry->vals, vals, nvals * sizeof(long));
+        apr_hash_set(loaded, apr_pstrdup(pool, key), APR_HASH_KEY_STRING,
+                     entry);
+    }
+
+    if (dbms_acl_can_fill(db))
+        dbms_acl_cache_put(generation, key, vals, nvals);
+}
+
+static long *dbms_acl_privilege_bounds(apr_pool_t *pool,
+                                       const dav_repos_db *db,
+                                       apr_hash_t *loaded, int load,
+                                       long priv_ns_id, const char *privilege,
+                                       int *nvals)
+{
+    const char *key = apr_psprintf(pool, "p%ld:%s", priv_ns_id, privilege);
+    long *vals = dbms_acl_lookup(pool, db, loaded, key, nvals);
+    apr_uint32_t generation;
+    dav_repos_query *q;
+
+    if (vals || !load)
+        return vals;
+
+    generation = dbms_acl_cache_generation();
+    q = dbms_prepare(pool, db->db, "SELECT lft, rgt FROM acl_privileges"
+                                   " WHERE name = ? AND priv_namespace_id = ?");
+    dbms_set_string(q, 1, privilege);
+    dbms_set_int(q, 2, priv_ns_id);
+    if (dbms_execute(q)) {
+        dbms_query_destroy(q);
+        return NULL;
+    }
+
+    vals = apr_pcalloc(pool, 2 * sizeof(long));
+    *nvals = 0;
+    if (dbms_next(q) > 0) {
+        vals[0] = dbms_get_int(q, 1);
+        vals[1] = dbms_get_int(q, 2);
+        *nvals = 2;
+    }
+    dbms_query_destroy(q);
+
+    dbms_acl_remember(db, loaded, generation, key, vals, *nvals);
+    return vals;
+}
+
+/**
+ * Loads the ACEs applying to resources, with one query
+ * @param pool - The pool to allocate from
+ * @param db - The DB connection struct
+ * @param loaded - The entries loaded by the request, NULL if none
+ * @param ids - The ids of the resources
+ * @param aces - Set to a hash of resource id -> array of the longs of its
+ * entry, for every one of the ids
+ * @return 0 on success
+ */
+static int dbms_acl_load_aces(apr_pool_t *pool, const dav_repos_db *db,
+                              apr_hash_t *loaded,
+                              const apr_array_header_t *ids,
+                              apr_hash_t **aces)
+{
+    apr_uint32_t generation = dbms_acl_cache_generation();
+    apr_array_header_t *vals;
+    dav_repos_query *q;
+    long resource_id, *key = NULL;
+    int ierrno, i;
+
+    q = dbms_prepare(pool, db->db,
+                     "SELECT chi_res.resource_id, aces.principal_id,"
+                     " aces.grantdeny, acl_privileges.lft, acl_privileges.rgt"
+                     " FROM acl_inheritance AS chi_res "
+                     "INNER JOIN acl_inheritance AS par_res "
+                     "ON par_res.resource_id = "
+                       "ANY(chi_res.path) "
+                     "INNER JOIN aces "
+                     "ON aces.resource_id = par_res.resource_id "
+                     "INNER JOIN dav_aces_privileges ap "
+                     "ON aces.id = ap.ace_id "
+                     "INNER JOIN acl_privileges "
+                     "ON acl_privileges.id = ap.privilege_id "
+                     "WHERE chi_res.resource_id = ANY(CAST(? AS BIGINT[])) "
+                     /* as dbms_is_allow orders them */
+                     "ORDER BY chi_res.resource_id, aces.protected DESC,"
+                     " array_upper(par_res.path, 1) DESC, aces.id");
+    dbms_set_string(q, 1, dbms_principal_groups_array(pool, ids));
+    dbms_set_fetch_size(q, db->fetch_size);
+    if (dbms_execute(q)) {
+        dbms_query_destroy(q);
+        return -1;
+    }
+
+    /* rows come resource by resource */
+    *aces = apr_hash_make(pool);
+    while ((ierrno = dbms_next(q)) > 0) {
+        resource_id = dbms_get_int(q, 1);
+        if (!key || resource_id != *key) {
+            key = apr_palloc(pool, sizeof(long));
+            *key = resource_id;
+            vals = apr_array_make(pool, 2 * ACL_ACE_VALS, sizeof(long));
+            apr_hash_set(*aces, key, sizeof(long), vals);
+        }
+        APR_ARRAY_PUSH(vals, long) = dbms_get_int(q, 2);
+        APR_ARRAY_PUSH(vals, long) =
+          (strcmp(dbms_get_string(q, 3), ACL_GRANT) == 0);
+        APR_ARRAY_PUSH(vals, long) = dbms_get_int(q, 4);
+        APR_ARRAY_PUSH(vals, long) = dbms_get_int(q, 5);
+    }
+    dbms_query_destroy(q);
+    if (ierrno < 0)
+        return -1;
+
+    for (i = 0; i < ids->nelts; i++) {
+        resource_id = APR_ARRAY_IDX(ids, i, long);
+        if (!(vals = apr_hash_get(*aces, &resource_id, sizeof(long)))) {
+            key = apr_palloc(pool, sizeof(long));
+            *key = resource_id;
+            vals = apr_array_make(pool, 1, sizeof(long));
+            apr_hash_set(*aces, key, sizeof(long), vals);
+        }
+        dbms_acl_remember(db, loaded, generation,
+                          apr_psprintf(pool, "r%ld", resource_id),
+                          (long *)vals->elts, vals->nelts);
+    }
+
+    return 0;
+}
+
+static long *dbms_acl_resource_aces(apr_pool_t *pool, const dav_repos_db *db,
+                                    apr_hash_t *loaded, int load,
+                                    long resource_id, int *nvals)
+{
+    const char *key = apr_psprintf(pool, "r%ld", resource_id);
+    long *vals = dbms_acl_lookup(pool, db, loaded, key, nvals);
+    apr_array_header_t *ids, *found;
+    apr_hash_t *aces;
+
+    if (vals || !load)
+        return vals;
+
+    ids = apr_array_make(pool, 1, sizeof(long));
+    APR_ARRAY_PUSH(ids, long) = resource_id;
+    if (dbms_acl_load_aces(pool, db, loaded, ids, &aces))
+        return NULL;
+
+    found = apr_hash_get(aces, &resource_id, sizeof(long));
+    *nvals = found->nelts;
+    return (long *)found->elts;
+}
+
+/**
+ * The privileges laid out as bits, read once per process: they only
+ * change with the schema
+ * @param db - The DB connection struct
+ * @return The layout, NULL on error or with more than ACL_MAX_PRIVILEGES
+ */
+static const dbms_acl_layout *dbms_acl_privileges(const dav_repos_db *db)
+{
+    dbms_acl_layout *layout = (dbms_acl_layout *)acl_layout;
+    dbms_acl_privilege *priv;
+    apr_pool_t *pool;
+    dav_repos_query *q;
+    int ierrno, i, j;
+
+    if (layout)
+        return layout;
+
+    /* for the life of the process, unless another thread got there first */
+    if (apr_pool_create(&pool, NULL) != APR_SUCCESS)
+        return NULL;
+    layout = apr_pcalloc(pool, sizeof(*layout));
+
+    q = dbms_prepare(pool, db->db,
+                     "SELECT namespaces.name, acl_privileges.name,"
+                     " acl_privileges.lft, acl_privileges.rgt"
+                     " FROM acl_privileges INNER JOIN namespaces"
+                     " ON namespaces.id = acl_privileges.priv_namespace_id"
+                     " ORDER BY acl_privileges.lft");
+    if (dbms_execute(q)) {
+        dbms_query_destroy(q);
+        apr_pool_destroy(pool);
+        return NULL;
+    }
+
+    while ((ierrno = dbms_next(q)) > 0
+           && layout->nprivs < ACL_MAX_PRIVILEGES) {
+        priv = &layout->privs[layout->nprivs++];
+        priv->ns = dbms_get_string(q, 1);
+        priv->name = dbms_get_string(q, 2);
+        priv->lft = dbms_get_int(q, 3);
+        priv->rgt = dbms_get_int(q, 4);
+        priv->xml = apr_psprintf(pool, "<D:privilege><D:%s/></D:privilege>"
+                                 DEBUG_CR, priv->name);
+        priv->xml_len = strlen(priv->xml);
+    }
+    dbms_query_destroy(q);
+
+    /* an error, or a row left over for want of bits */
+    if (ierrno != 0) {
+        apr_pool_destroy(pool);
+        return NULL;
+    }
+
+    for (i = 0; i < layout->nprivs; i++)
+        for (j = i; j < layout->nprivs
+               && layout->privs[j].lft < layout->privs[i].rgt; j++)
+            layout->privs[i].mask |= (dbms_acl_mask)1 << j;
+
+    if (apr_atomic_casptr(&acl_layout, layout, NULL) != NULL) {
+        apr_pool_destroy(pool);
+        layout = (dbms_acl_layout *)acl_layout;
+    }
+    return layout;
+}
+
+static int dbms_acl_compare_lft(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = ((const dbms_acl_privilege *)b)->lft;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * The privileges a principal is granted, in one pass over the ACEs in
+ * the precedence of dbms_is_allow: each privilege is decided by the first
+ * ACE of the principal or one of its groups whose privilege contains it
+ * @param layout - The privileges
+ * @param aces - The ACEs applying to the resource
+ * @param naces - The number of values in aces
+ * @param groups - The principal and its groups, sorted
+ * @param granted - Set to the privileges granted
+ * @return 0 on success, -1 when an ACE has a privilege the layout lacks
+ */
+static int dbms_acl_granted(const dbms_acl_layout *layout, const long *aces,
+                            int naces, const apr_array_header_t *groups,
+                            dbms_acl_mask *granted)
+{
+    dbms_acl_mask decided = 0, mask;
+    const dbms_acl_privilege *priv;
+    int i;
+
+    *granted = 0;
+    for (i = 0; i + ACL_ACE_VALS <= naces; i += ACL_ACE_VALS) {
+        if (!bsearch(&aces[i], groups->elts, groups->nelts, sizeof(long),
+                     dbms_compare_ids))
+            continue;
+
+        priv = bsearch(&aces[i + 2], layout->privs, layout->nprivs,
+                       sizeof(dbms_acl_privilege), dbms_acl_compare_lft);
+        if (!priv)
+            return -1;
+
+        mask = priv->mask & ~decided;
+        if (aces[i + 1])
+            *granted |= mask;
+        decided |= mask;
+    }
+
+    return 0;
+}
+
+/**
+ * The privileges a principal is granted on a resource, computed in the
+ * process. The ACEs are loaded if need be, for the request alone when it
+ * may not fill the ACL cache
+ * @return 0 on success, -1 when a query is needed after all
+ */
+static int dbms_acl_privilege_set(const dav_repos_db *db, request_rec *rec,
+                                  apr_pool_t *pool,
+                                  const apr_array_header_t *groups,
+                                  long resource_id,
+                                  const dbms_acl_layout **layout,
+                                  dbms_acl_mask *granted)
+{
+    long *aces;
+    int naces;
+
+    if (!(*layout = dbms_acl_privileges(db))
+        || !(aces = dbms_acl_resource_aces(pool, db, dbms_acl_loaded(rec), 1,
+                                           resource_id, &naces)))
+        return -1;
+
+    return dbms_acl_granted(*layout, aces, naces, groups, granted);
+}
+
+/* the precedence of dbms_is_allow: the first ACE of the principal or one
+ * of its groups whose privilege contains the one asked for wins */
+static int dbms_acl_decide(const long *aces, int naces,
+                           const apr_array_header_t *groups,
+                           long lft, long rgt)
+{
+    int i;
+
+    for (i = 0; i + ACL_ACE_VALS <= naces; i += ACL_ACE_VALS)
+        if (aces[i + 2] <= lft && aces[i + 3] >= rgt
+            && bsearch(&aces[i], groups->elts, groups->nelts, sizeof(long),
+                       dbms_compare_ids))
+            return aces[i + 1] ? TRUE : FALSE;
+
+    return FALSE;
+}
+
+/**
+ * Decide an ACL check in the process
+ * @return TRUE or FALSE, -1 if it cannot be told without a query
+ */
+static int dbms_acl_cached_is_allow(const dav_repos_db *db, apr_hash_t *loaded,
+                                    apr_pool_t *pool,
+                                    long priv_ns_id, const char *privilege,
+                                    long principal_id, long resource_id)
+{
+    long *bounds, *aces;
+    int nbounds, naces, load = dbms_acl_can_fill(db);
+    apr_array_header_t *groups;
+
+    if (!(bounds = dbms_acl_privilege_bounds(pool, db, loaded, load,
+                                             priv_ns_id, privilege, &nbounds))
+        || !(aces = dbms_acl_resource_aces(pool, db, loaded, load,
+                                           resource_id, &naces))
+        || dbms_get_principal_groups(pool, db, principal_id, &groups))
+        return -1;
+
+    if (!nbounds)
+        return FALSE;
+
+    return dbms_acl_decide(aces, naces, groups, bounds[0], bounds[1]);
+}
+
+int dbms_acl_prefetch(const dav_repos_db *db, request_rec *rec,
+                      apr_pool_t *pool, const apr_array_header_t *ids)
+{
+    apr_hash_t *loaded = dbms_acl_loaded(rec), *aces;
+    apr_array_header_t *missing;
+    int nvals, i;
+
+    TRACE();
+
+    missing = apr_array_make(pool, ids->nelts + 1, sizeof(long));
+    for (i = 0; i < ids->nelts; i++) {
+        long resource_id = APR_ARRAY_IDX(ids, i, long);
+        if (!dbms_acl_lookup(pool, db, loaded,
+                             apr_psprintf(pool, "r%ld", resource_id), &nvals))
+            APR_ARRAY_PUSH(missing, long) = resource_id;
+    }
+
+    if (missing->nelts == 0)
+        return 0;
+    return dbms_acl_load_aces(pool, db, loaded, missing, &aces);
+}
+
+dav_error *dbms_is_allow_many(const dav_repos_db *db, request_rec *rec,
+                              apr_pool_t *pool, long priv_ns_id,
+                              const char *privilege,
+                              const dav_principal *principal,
+                              const apr_array_header_t *ids, int **allowed)
+{
+    apr_hash_t *loaded = dbms_acl_loaded(rec), *aces = NULL;
+    apr_array_header_t *missing, *groups, *found;
+    long p_id = dav_repos_get_principal_id(principal), *bounds, resource_id;
+    dbms_acl_entry *entries;
+    int nbounds, i;
+    dav_error *err;
+
+    TRACE();
+
+    *allowed = apr_pcalloc(pool, (ids->nelts + 1) * sizeof(int));
+
+    /* NOTE: short circuiting ACL checks for super user */
+    if (p_id == SUPER_USER_ID) {
+        for (i = 0; i < ids->nelts; i++)
+            (*allowed)[i] = TRUE;
+        return NULL;
+    }
+
+    if (!(bounds = dbms_acl_privilege_bounds(pool, db, loaded, 1, priv_ns_id,
+                                             privilege, &nbounds)))
+        return dav_new_error(pool, HTTP_INTERNAL_SERVER_ERROR, 0,
+                             "DBMS error while reading privileges");
+    if (!nbounds)
+        return NULL;
+
+    if ((err = dbms_get_principal_groups(pool, db, p_id, &groups)))
+        return err;
+
+    /* what neither the request nor the cache has is read in one query */
+    entries = apr_pcalloc(pool, (ids->nelts + 1) * sizeof(*entries));
+    missing = apr_array_make(pool, ids->nelts + 1, sizeof(long));
+    for (i = 0; i < ids->nelts; i++) {
+        resource_id = APR_ARRAY_IDX(ids, i, long);
+        entries[i].vals =
+          dbms_acl_lookup(pool, db, loaded,
+                          apr_psprintf(pool, "r%ld", resource_id),
+                          &entries[i].nvals);
+        if (!entries[i].vals)
+            APR_ARRAY_PUSH(missing, long) = resource_id;
+    }
+
+    if (missing->nelts && dbms_acl_load_aces(pool, db, loaded, missing, &aces))
+        return dav_new_error(pool, HTTP_INTERNAL_SERVER_ERROR, 0,
+                             "DBMS error while reading ACEs");
+
+    for (i = 0; i < ids->nelts; i++) {
+        if (!entries[i].vals) {
+            resource_id = APR_ARRAY_IDX(ids, i, long);
+            found = apr_hash_get(aces, &resource_id, sizeof(long));
+            entries[i].vals = (long *)found->elts;
+            entries[i].nvals = found->nelts;
+        }
+        (*allowed)[i] = dbms_acl_decide(entries[i].vals, entries[i].nvals,
+                                        groups, bounds[0], bounds[1]);
+    }
+
+    return NULL;
+}
+
+static const char *make_member_query(apr_pool_t *pool, int order)
 {
     return apr_psprintf(pool, 
-                        " SELECT %d AS p_id, transitive_group_id AS group_id"
-                         " FROM transitive_group_members"
-                         " WHERE transitive_member_id = %ld"
-                        " UNION (SELECT %d, %ld)", order, p_id, order, p_id);
+                        " SELECT %d AS p_id,"
+                        " unnest(CAST(? AS BIGINT[])) AS group_id", order);
 }
 
 /**
@@ -460,6 +961,7 @@ int dbms_is_allow(const dav_repos_db * db, long priv_ns_id,
     long p_id = dav_repos_get_principal_id(principal);
     const dav_principal *iter = principal;
     apr_pool_t *pool = r->p;
+    request_rec *rec = r->resource ? r->resource->info->rec : NULL;
 
     TRACE();
 
@@ -476,13 +978,30 @@ int dbms_is_allow(const dav_repos_db * db, long priv_ns_id,
         return r->ace_cache->is_allow;
     }
 
-    int order = 1;
-    const char *members_query = make_member_query(pool, p_id, order);
-    while((iter = iter->next)) {
+    /* the first principal decides, see below */
+    if ((retVal = dbms_acl_cached_is_allow(db, dbms_acl_loaded(rec), pool,
+                                           priv_ns_id, privilege,
+                                           p_id, r->serialno)) != -1)
+        return retVal;
+    retVal = FALSE;
+
+    /* the group closures are bound as arrays, one per principal */
+    apr_array_header_t *memberships = 
+        apr_array_make(pool, 2, sizeof(const char *));
+    apr_array_header_t *groups;
+    const char *members_query = "";
+    int order = 0, i;
+    for (iter = principal; iter; iter = iter->next) {
         order = order + 1;
-        p_id = dav_repos_get_principal_id(iter);
-        members_query = apr_pstrcat(pool, members_query, " UNION ",
-                                    make_member_query(pool, p_id, order), NULL);
+        if (dbms_get_principal_groups(pool, db, 
+                                      dav_repos_get_principal_id(iter), 
+                                      &groups))
+            return HTTP_INTERNAL_SERVER_ERROR;
+        APR_ARRAY_PUSH(memberships, const char *) = 
+            dbms_principal_groups_array(pool, groups);
+        members_query = apr_pstrcat(pool, members_query, 
+                                    order > 1 ? " UNION ALL " : "",
+                                    make_member_query(pool, order), NULL);
     }
     int max_order = order;
 
@@ -515,21 +1034,22 @@ int dbms_is_allow(const dav_repos_db * db, long priv_ns_id,
                         "FROM acl_inheritance AS par_res "
                         "INNER JOIN acl_inheritance AS chi_res "
                         "ON par_res.resource_id = "
-                          "ANY(CAST(string_to_array(chi_res.path, ',') "
-                             "AS INTEGER[])) "
+                          "ANY(chi_res.path) "
                         "WHERE chi_res.resource_id = ? ) inherited_res "
                       "ON aces.resource_id = inherited_res.resource_id "
 
                      /* give priority to own aces over those inherited
                       * then protected aces, and to aces higher in the list
                         submitted by the client(translates to a lower id) */
-                     "ORDER BY p_id, protected DESC, CHAR_LENGTH(par_res_path) DESC,"
+                     "ORDER BY p_id, protected DESC, array_upper(par_res_path, 1) DESC,"
                      " id ", members_query);
 
-    q = dbms_prepare(pool, db->db, is_allow_query);
-    dbms_set_string(q, 1, privilege);
-    dbms_set_int(q, 2, priv_ns_id);
-    dbms_set_int(q, 3, r->serialno);
+    q = dbms_prepare_dynamic(pool, db->db, is_allow_query);
+    for (i = 0; i < max_order; i++)
+        dbms_set_string(q, i + 1, APR_ARRAY_IDX(memberships, i, const char *));
+    dbms_set_string(q, max_order + 1, privilege);
+    dbms_set_int(q, max_order + 2, priv_ns_id);
+    dbms_set_int(q, max_order + 3, r->serialno);
 
     if (dbms_execute(q)) {
 	dbms_query_destroy(q);
@@ -575,16 +1095,34 @@ int dbms_is_allow(const dav_repos_db * db, long priv_ns_id,
 /**
  * Get all privileges for given (user, resource)
  * @param db DB connection struct
+ * @param rec The request
  * @param pool The pool to allocate from
  * @param user The name of the user
  * @param resource_id id of the resource
  */
-dav_privileges *dbms_get_privileges(const dav_repos_db * db,
+dav_privileges *dbms_get_privileges(const dav_repos_db * db, request_rec *rec,
 				    apr_pool_t * pool, long principal_id,
 				    long resource_id)
 {
     dav_privileges *privileges = dav_privileges_new(pool);
     dav_repos_query *q = NULL;
+    apr_array_header_t *groups;
+    const dbms_acl_layout *layout;
+    dbms_acl_mask granted;
+    int i;
+
+    if (dbms_get_principal_groups(pool, db, principal_id, &groups))
+        return privileges;
+
+    if (dbms_acl_privilege_set(db, rec, pool, groups, resource_id,
+                               &layout, &granted) == 0) {
+        for (i = 0; i < layout->nprivs; i++)
+            if (granted & ((dbms_acl_mask)1 << i))
+                dav_add_privilege(privileges, dav_privilege_new_by_name
+                                  (pool, layout->privs[i].ns,
+                                   layout->privs[i].name));
+        return privileges;
+    }
 
     q = dbms_prepare
       (pool, db->db,
@@ -595,16 +1133,6 @@ dav_privileges *dbms_get_privileges(const dav_repos_db * db,
                        "SELECT aces.grantdeny"
                        " FROM aces INNER JOIN dav_aces_privileges ap"
                                    " ON aces.id = ap.ace_id "
-                                   "INNER JOIN ("
-                                                "("
-                                                  "SELECT transitive_group_id"
-                                                  " AS group_id"
-                                                  " FROM transitive_group_members"
-                                                  " WHERE transitive_member_id=?"
-                                                  ") "
-                                                "UNION (SELECT ?)"
-                                                ") membership"
-                                   " ON aces.principal_id = membership.group_id "
                                    "INNER JOIN ("
                                                 "SELECT par_priv.id AS par_priv_id,"
                                                 " chi_priv.id AS chi_priv_id"
@@ -621,13 +1149,13 @@ dav_privileges *dbms_get_privileges(const dav_repos_db * db,
                                       "FROM acl_inheritance AS par_res "
                                       "INNER JOIN acl_inheritance AS chi_res "
                                       "ON par_res.resource_id = "
-                                         "ANY(CAST(string_to_array(chi_res.path, ',') "
-                                           "AS INTEGER[])) "
+                                         "ANY(chi_res.path) "
                                       "WHERE chi_res.resource_id = ? ) inherited_res "
                                    "ON aces.resource_id = inherited_res.resource_id "
        
                        " WHERE chi_priv_id = outer_priv.id"
-                       " ORDER BY protected DESC, CHAR_LENGTH(par_res_path) DESC, id LIMIT 1)"
+                       " AND aces.principal_id = ANY(CAST(? AS BIGINT[]))"
+                       " ORDER BY protected DESC, array_upper(par_res_path, 1) DESC, id LIMIT 1)"
                        " AS action"
                        " FROM acl_privileges outer_priv "
                               "INNER JOIN "
@@ -635,9 +1163,8 @@ dav_privileges *dbms_get_privileges(const dav_repos_db * db,
                               "  ON namespaces.id = outer_priv.priv_namespace_id"
                ") AS final_priv"
        " WHERE action = 'G'");
-    dbms_set_int(q, 1, principal_id);
-    dbms_set_int(q, 2, principal_id);
-    dbms_set_int(q, 3, resource_id);
+    dbms_set_int(q, 1, resource_id);
+    dbms_set_string(q, 2, dbms_principal_groups_array(pool, groups));
 
     dbms_execute(q);
 
@@ -651,6 +1178,48 @@ dav_privileges *dbms_get_privileges(const dav_repos_db * db,
     return privileges;
 }
 
+/**
+ * Render the privileges of a principal on a resource as the content of
+ * a DAV:current-user-privilege-set
+ * @param db DB connection struct
+ * @param rec The request
+ * @param pool The pool to allocate from
+ * @param principal_id id of the principal
+ * @param resource_id id of the resource
+ * @return The DAV:privilege elements, NULL if they could not be computed
+ * in the process
+ */
+char *dbms_get_privilege_set_xml(const dav_repos_db *db, request_rec *rec,
+                                 apr_pool_t *pool, long principal_id,
+                                 long resource_id)
+{
+    apr_array_header_t *groups;
+    const dbms_acl_layout *layout;
+    dbms_acl_mask granted;
+    apr_size_t len = 0;
+    char *xml, *end;
+    int i;
+
+    if (dbms_get_principal_groups(pool, db, principal_id, &groups)
+        || dbms_acl_privilege_set(db, rec, pool, groups, resource_id,
+                                  &layout, &granted))
+        return NULL;
+
+    for (i = 0; i < layout->nprivs; i++)
+        if (granted & ((dbms_acl_mask)1 << i))
+            len += layout->privs[i].xml_len;
+
+    end = xml = apr_palloc(pool, len + 1);
+    for (i = 0; i < layout->nprivs; i++)
+        if (granted & ((dbms_acl_mask)1 << i)) {
+            memcpy(end, layout->privs[i].xml, layout->privs[i].xml_len);
+            end += layout->privs[i].xml_len;
+        }
+    *end = '\0';
+
+    return xml;
+}
+
 /**
  * Add a (resource, parent) entry into acl_inheritance table,
  * if not already done.
@@ -686,10 +1255,12 @@ dav_error *dbms_inherit_parent_aces(const dav_repos_db *d,
     }
     dbms_query_destroy(q);
 
-    /* Insert the new entry (resource, parent) with proper lft & rgt values */
+    /* Insert the new entry (resource, parent) with proper lft & rgt values.
+     * The ACL cache is left alone: the resource is new to this transaction,
+     * so nothing else has checked its ACL yet */
     q = dbms_prepare(pool, d->db,
                      "INSERT INTO acl_inheritance (resource_id, path)"
-                     " SELECT ?, a.path || ',' || ?"
+                     " SELECT ?, a.path || CAST(? AS BIGINT)"
                      " FROM acl_inheritance a WHERE a.resource_id = ?");
     dbms_set_int(q, 1, db_r->serialno);
     dbms_set_int(q, 2, db_r->serialno);
@@ -740,6 +1311,7 @@ dav_error *dbms_update_principal_property_aces(dav_repos_db *d,
     dbms_set_int(q, 2, db_r->serialno);
     dbms_set_int(q, 3, prop_ns_id);
     dbms_set_string(q, 4, prop_name);
+    dbms_acl_cache_invalidate();
 
     if (dbms_execute(q))
         err =  dav_new_error(pool, HTTP_INTERNAL_SERVER_ERROR, 0,
@@ -813,13 +1385,17 @@ dav_error *dbms_change_acl_parent(dav_repos_db *d,
 {
     dav_repos_query *q = NULL;
     apr_pool_t *pool = db_r->p;
-    char *orig_path, *new_parent_path, *new_path; 
+    char *new_parent_path;
+    int orig_depth;
     dav_error *err = NULL;
 
     TRACE();
 
-    /* Get current path */
-    q = dbms_prepare(pool, d->db, "SELECT path FROM acl_inheritance"
+    dbms_acl_cache_invalidate();
+
+    /* Get current depth */
+    q = dbms_prepare(pool, d->db, "SELECT array_upper(path, 1)"
+                                  " FROM acl_inheritance"
                                   " WHERE resource_id = ?");
     dbms_set_int(q, 1, db_r->serialno);
     dbms_execute(q);
@@ -828,7 +1404,7 @@ dav_error *dbms_change_acl_parent(dav_repos_db *d,
         /* Not currently part of acl_inheritance, just add it */
         return dbms_inherit_parent_aces(d, db_r, new_parent_id);
     } else {
-        orig_path = dbms_get_string(q, 1);
+        orig_depth = dbms_get_int(q, 1);
         dbms_query_destroy(q);
     }
 
@@ -846,17 +1422,16 @@ dav_error *dbms_change_acl_parent(dav_repos_db *d,
         dbms_query_destroy(q);
     }
 
-    new_path = apr_psprintf(pool, "%s,%ld", new_parent_path, db_r->serialno);
-
-    /* Update path(s) */
+    /* Update path(s): those holding the resource are its own and its
+     * descendants', found through the GIN index. They keep their part
+     * from the resource down, after the new parent's path */
     q = dbms_prepare(pool, d->db, "UPDATE acl_inheritance"
-                                  " SET path = replace(path, ?, ?)"
-                                  " WHERE path LIKE ?"
-                                  " OR path = ?");
-    dbms_set_string(q, 1, orig_path);
-    dbms_set_string(q, 2, new_path);
-    dbms_set_string(q, 3, apr_pstrcat(pool, orig_path, ",%", NULL));
-    dbms_set_string(q, 4, orig_path);
+                                  " SET path = CAST(? AS BIGINT[])"
+                                  " || path[? : array_upper(path, 1)]"
+                                  " WHERE path @> ARRAY[CAST(? AS BIGINT)]");
+    dbms_set_string(q, 1, new_parent_path);
+    dbms_set_int(q, 2, orig_depth);
+    dbms_set_int(q, 3, db_r->serialno);
 
     if (dbms_execute(q))
         err = dav_new_error(pool, HTTP_INTERNAL_SERVER_ERROR, 0,
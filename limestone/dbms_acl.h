@@ -72,10 +72,47 @@ int dbms_get_acl(const dav_repos_db * d, dav_repos_resource * r);
 int dbms_is_allow(const dav_repos_db * db, long priv_ns_id, const char *privilege, 
                   const dav_principal *principal, dav_repos_resource *r);
 
-dav_privileges *dbms_get_privileges(const dav_repos_db * db,
+dav_privileges *dbms_get_privileges(const dav_repos_db * db, request_rec *rec,
 				    apr_pool_t * pool, long principal_id,
 				    long resource_id);
 
+char *dbms_get_privilege_set_xml(const dav_repos_db *db, request_rec *rec,
+                                 apr_pool_t *pool, long principal_id,
+                                 long resource_id);
+
+/**
+ * Loads the ACEs applying to resources the request is about to check one
+ * by one, with one query for all those not loaded yet, so that
+ * dbms_is_allow and dbms_get_privileges decide them in the process
+ * @param db DB connection struct
+ * @param rec The request
+ * @param pool The pool to allocate from
+ * @param ids The ids of the resources
+ * @return 0 on success
+ */
+int dbms_acl_prefetch(const dav_repos_db *db, request_rec *rec,
+                      apr_pool_t *pool, const apr_array_header_t *ids);
+
+/**
+ * Check permissions of a principal on many resources at once, with at
+ * most one query for the ACEs and none for those the request or the ACL
+ * cache already has. Like dbms_is_allow, the first principal decides
+ * @param db DB connection struct
+ * @param rec The request
+ * @param pool The pool to allocate from
+ * @param priv_ns_id The namespace id of the privilege
+ * @param privilege Name of the privilege
+ * @param principal The principal
+ * @param ids The ids of the resources
+ * @param allowed Set to TRUE or FALSE for each of the ids, in order
+ * @return NULL on success
+ */
+dav_error *dbms_is_allow_many(const dav_repos_db *db, request_rec *rec,
+                              apr_pool_t *pool, long priv_ns_id,
+                              const char *privilege,
+                              const dav_principal *principal,
+                              const apr_array_header_t *ids, int **allowed);
+
 dav_error *dbms_inherit_parent_aces(const dav_repos_db *d, 
                                     const dav_repos_resource *db_r, 
                                     int parent);
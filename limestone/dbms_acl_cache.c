@@ -0,0 +1,103 @@
+/* ====================================================================
+ * Copyright 2007 Lime Spot LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * ====================================================================
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dbms_acl_cache.h"
+#include "lru_cache.h"
+
+typedef struct {
+    dav_repos_lru_node lru;
+    int nvals;
+    long vals[1];                   /* followed by the key */
+} acl_node;
+
+/* bumped on every change to ACLs */
+static dav_repos_lru_cache cache =
+  DAV_REPOS_LRU_CACHE_INIT(cache, "dav_repos_acl_cache_shm");
+
+apr_status_t dbms_acl_cache_init(apr_pool_t *pproc)
+{
+    return dav_repos_lru_cache_init(&cache, pproc);
+}
+
+void dbms_acl_cache_child_init(apr_pool_t *pchild, int size,
+                               apr_interval_time_t ttl)
+{
+    if (size > 0)
+        dav_repos_lru_cache_child_init(&cache, pchild, size, ttl);
+}
+
+int dbms_acl_cache_enabled(void)
+{
+    return dav_repos_lru_cache_enabled(&cache);
+}
+
+apr_uint32_t dbms_acl_cache_generation(void)
+{
+    return dav_repos_lru_cache_generation(&cache);
+}
+
+void dbms_acl_cache_invalidate(void)
+{
+    dav_repos_lru_cache_invalidate(&cache);
+}
+
+long *dbms_acl_cache_get(apr_pool_t *pool, apr_uint32_t generation,
+                         const char *key, int *nvals)
+{
+    acl_node *node = dav_repos_lru_cache_get(&cache, pool, generation,
+                                             key, strlen(key));
+
+    if (!node)
+        return NULL;
+
+    /* never NULL, even for an empty entry */
+    *nvals = node->nvals;
+    return node->vals;
+}
+
+void dbms_acl_cache_put(apr_uint32_t generation, const char *key,
+                        const long *vals, int nvals)
+{
+    apr_size_t klen, offset;
+    acl_node *node;
+    char *nkey;
+
+    if (!dav_repos_lru_cache_current(&cache, generation))
+        return;
+
+    klen = strlen(key);
+    offset = offsetof(acl_node, vals) + nvals * sizeof(long);
+    node = malloc(offset + klen + 1);
+    if (!node)
+        return;
+
+    node->nvals = nvals;
+    memcpy(node->vals, vals, nvals * sizeof(long));
+    nkey = (char *)node + offset;
+    memcpy(nkey, key, klen + 1);
+    node->lru.key = nkey;
+    node->lru.klen = klen;
+    node->lru.alloc = offset + klen + 1;
+    node->lru.cost = 1;
+
+    dav_repos_lru_cache_put(&cache, generation, &node->lru);
+}
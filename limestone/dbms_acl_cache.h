@@ -0,0 +1,88 @@
+/* ====================================================================
+ * Copyright 2007 Lime Spot LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * ====================================================================
+ */
+
+#ifndef __DBMS_ACL_CACHE_H__
+#define __DBMS_ACL_CACHE_H__
+
+#include <apr_pools.h>
+#include <apr_time.h>
+
+/**
+ * Per-process LRU cache of what ACL checks are decided from, besides the
+ * groups of the principal: the nested set bounds of privileges and the
+ * ACEs applying to resources, each held as an array of longs under a
+ * key. Every change to ACLs bumps a generation counter shared by all
+ * processes of the server; entries filled under an older generation are
+ * never served. Changes made by other servers do not bump it, so no
+ * entry is served for longer than the time to live either.
+ */
+
+/**
+ * Sets up the shared generation counter, before the children are forked
+ * @param pproc - The process pool
+ * @return APR_SUCCESS, or why the counter is private to each process
+ */
+apr_status_t dbms_acl_cache_init(apr_pool_t *pproc);
+
+/**
+ * Sets up this process' cache
+ * @param pchild - The child's pool
+ * @param size - The most entries to hold, 0 to disable the cache
+ * @param ttl - How long an entry is served for
+ */
+void dbms_acl_cache_child_init(apr_pool_t *pchild, int size,
+                               apr_interval_time_t ttl);
+
+/**
+ * @return 1 if this process has a cache, 0 otherwise
+ */
+int dbms_acl_cache_enabled(void);
+
+/**
+ * @return The current generation. Read it before the request reads
+ * anything that is going to be put into the cache
+ */
+apr_uint32_t dbms_acl_cache_generation(void);
+
+/**
+ * Drops every cached entry, in this process and all others
+ */
+void dbms_acl_cache_invalidate(void);
+
+/**
+ * Looks up an entry
+ * @param pool - The pool to copy the values into
+ * @param generation - The generation the caller read its data under
+ * @param key - The key of the entry
+ * @param nvals - Set to the number of values
+ * @return A copy of the values, NULL if not found
+ */
+long *dbms_acl_cache_get(apr_pool_t *pool, apr_uint32_t generation,
+                         const char *key, int *nvals);
+
+/**
+ * Remembers an entry
+ * @param generation - The generation read before the values were queried
+ * @param key - The key of the entry
+ * @param vals - The values
+ * @param nvals - The number of values
+ */
+void dbms_acl_cache_put(apr_uint32_t generation, const char *key,
+                        const long *vals, int nvals);
+
+#endif /* __DBMS_ACL_CACHE_H__ */
@@ -20,10 +20,13 @@
 #define DBMS_API_H
 
 #include "dbms_transaction.h"   /* required for  dav_repos_transaction */
+#include "dbms_trace.h"
 #ifndef DAV_REPOS_DBMS_OPAQUE_T
 #define DAV_REPOS_DBMS_OPAQUE_T
 struct dav_repos_dbms;
 typedef struct dav_repos_dbms dav_repos_dbms;
+struct dbms_replica;
+typedef struct dbms_replica dbms_replica;
 #endif
 
 /**
@@ -68,6 +71,84 @@ dav_repos_dbms *dbms_api_opendb(apr_pool_t *pool, void *p);
 dav_repos_dbms *dbms_api_opendb_params(apr_pool_t *pool,
                                        const char *driver, const char *params);
 
+/**
+ * Sets up the connections to a read replica for this process. Nothing
+ * is opened until a request asks for a connection
+ * @param pool - The process pool; connections are closed with it
+ * @param driver - The apr_dbd driver name
+ * @param params - The driver's connection parameters
+ * @param max - The most connections to keep open at once
+ * @return The replica, NULL if the driver could not be loaded
+ */
+dbms_replica *dbms_api_replica_create(apr_pool_t *pool, const char *driver,
+                                      const char *params, int max);
+
+/**
+ * Takes a replica connection for the length of a request
+ * @param pool - The memory pool to allocate from
+ * @param r - The request; the connection is given back when it ends
+ * @param replica - The replica to connect to
+ * @return A handle to the database. NULL if no connection could be had
+ */
+dav_repos_dbms *dbms_api_opendb_replica(apr_pool_t *pool, request_rec *r,
+                                        dbms_replica *replica);
+
+/**
+ * Tells whether a handle is connected to a read replica
+ * @param db - The handle to the database
+ * @return 1 for a replica, 0 for the primary
+ */
+int dbms_api_is_replica(const dav_repos_dbms *db);
+
+/**
+ * Attaches a request's SQL trace to a database handle
+ * @param db - The handle to the database
+ * @param trace - The trace, NULL to stop tracing
+ * @see #dbms_trace_start
+ */
+void dbms_api_set_trace(dav_repos_dbms *db, dbms_trace *trace);
+
+/**
+ * Makes a database handle count how often each query template is executed
+ * during the request, to catch queries issued once per resource in a loop
+ * @param db - The handle to the database
+ * @param warn - log a warning the first time a template runs more than this
+ *   many times, 0 for no warning
+ * @param budget - fail any execution of a template beyond this many, 0 for
+ *   no limit
+ */
+void dbms_api_set_repeat_limits(dav_repos_dbms *db, int warn, int budget);
+
+/**
+ * Tells whether a statement was failed for going over the budget, which
+ * leaves whatever the request was writing half done
+ * @param db - The handle to the database
+ * @return 1 if so, 0 otherwise
+ */
+int dbms_api_over_budget(const dav_repos_dbms *db);
+
+/**
+ * Session settings only need to be applied once per physical connection
+ * @param db - The handle to the database
+ * @return 1 if they have already been applied on db's connection
+ */
+int dbms_api_session_ready(const dav_repos_dbms *db);
+
+/**
+ * Marks the session settings of db's connection as applied
+ * @param db - The handle to the database
+ */
+void dbms_api_set_session_ready(const dav_repos_dbms *db);
+
+/**
+ * Sets a tag, e.g. the request's UNIQUE_ID, to be sent as a comment with
+ * every statement run through db, so that statements in the database logs
+ * can be correlated with requests
+ * @param db - The handle to the database
+ * @param tag - The tag, NULL for none
+ */
+void dbms_api_set_tag(dav_repos_dbms *db, const char *tag);
+
 /** 
  * Closes an open database connection
  * @param db - The handle to the database
@@ -92,6 +173,23 @@ dav_repos_query *dbms_prepare(apr_pool_t * pool,
 			      const dav_repos_dbms * dbms,
 			      const char *query);
 
+/**
+ * Like dbms_prepare, but for query strings assembled at runtime (e.g. with
+ * apr_psprintf). Queries with placeholders are otherwise kept as
+ * server-side prepared statements on the connection, keyed by the query
+ * string; dynamic queries would only fill that cache with one-off entries,
+ * so they always have their parameters spliced into the query text.
+ * Queries without any placeholders always take that path.
+ * @param pool - The memory pool to allocate from.
+ * @param dbms - The database to perform the query on.
+ * @param query - The query string, with "?" placeholders
+ * @return the query handle
+ * @see #dbms_prepare
+ */
+dav_repos_query *dbms_prepare_dynamic(apr_pool_t * pool,
+                                      const dav_repos_dbms * dbms,
+                                      const char *query);
+
 /**
  * Replaces a placeholder "?" with an integer value.
  * @param query - The query that you would like to place the value in.
@@ -141,11 +239,36 @@ const char *dbms_escape(apr_pool_t *pool, const dav_repos_dbms *db,
                         const char *string);
 
 /**
- * Executes the query.
+ * Makes a SELECT stream its results instead of having the whole result
+ * set buffered on execution. Rows are then pulled from a server-side
+ * cursor in batches of fetch_size as dbms_next walks past them, and only
+ * the current batch is kept in memory. Must be called before
+ * dbms_execute. Outside of a transaction, or on databases other than
+ * PostgreSQL, the results are buffered as usual.
+ * In streaming mode only dbms_next and dbms_get_* may be used to read the
+ * results; dbms_results_count returns -1.
+ * @param query - the query handle
+ * @param fetch_size - rows per batch, 0 or less to buffer the whole result set
+ * @return 0 on success
+ */
+int dbms_set_fetch_size(dav_repos_query *query, int fetch_size);
+
+/**
+ * Executes the query. The calling function is recorded in the SQL trace
+ * of traced requests.
+ * @param query - The query to execute
+ * @return 0 on success
+ */
+#define dbms_execute(query) dbms_execute_at((query), __func__)
+
+/**
+ * Executes the query on behalf of the named function.
  * @param query - The query to execute
+ * @param caller - The function to charge the query to in the SQL trace
  * @return 0 on success
+ * @see #dbms_execute
  */
-int dbms_execute(dav_repos_query * query);
+int dbms_execute_at(dav_repos_query * query, const char *caller);
 
 /**
  * @param query - the query handle
@@ -182,6 +305,16 @@ long long dbms_get_int(dav_repos_query * query, int column);
  */
 char *dbms_get_string(dav_repos_query * query, int column);
 
+/**
+ * Copies the current row, as positioned by dbms_next, into an array of
+ * strings
+ * @param query - the query handle
+ * @param pool - pool to allocate the row from
+ * @return the row, NULL if there is no current row
+ * @see #dbms_next
+ */
+char **dbms_get_row(dav_repos_query * query, apr_pool_t * pool);
+
 /**
  * Releases any resources allocated for this query.
  * @param query - the query handle
@@ -239,6 +372,40 @@ int dbms_results_count(dav_repos_query* q);
 int dbms_transaction_start(apr_pool_t * pool, const dav_repos_db *d,
                            dav_repos_transaction **trans);
 
+/** 
+ * Starts a transaction that only reads. On PostgreSQL it is started READ
+ * ONLY, with the characteristics configured by
+ * DAVLimestoneReadOnlyTransactions, and constraints are not deferred.
+ * Elsewhere, or when read-only transactions are turned off, this is the
+ * same as dbms_transaction_start.
+ * @param pool - pool to allocate resources from
+ * @param d - handle to database
+ * @param trans - handle to the newly created transaction
+ * @return 0 on success, error number otherwise
+ */
+int dbms_transaction_start_read_only(apr_pool_t * pool, const dav_repos_db *d,
+                                     dav_repos_transaction **trans);
+
+/**
+ * @param db - handle to database
+ * @return 1 if db is in a transaction that was started READ ONLY
+ */
+int dbms_api_read_only(const dav_repos_dbms *db);
+
+/**
+ * @param db - handle to database
+ * @return 1 if db is in a transaction
+ */
+int dbms_api_in_transaction(const dav_repos_dbms *db);
+
+/**
+ * Counts the writes and transaction boundaries seen by db's connection;
+ * what was read through db is known to still hold while this is unchanged
+ * @param db - handle to database
+ * @return the count, -1 if it isn't kept for db
+ */
+int dbms_api_epoch(const dav_repos_dbms *db);
+
 /** 
  * Ends a transaction
  * @param trans - transaction handle
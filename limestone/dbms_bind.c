@@ -17,16 +17,75 @@
  */
 
 #include "dbms_bind.h"
+#include "dbms_bind_cache.h"
 #include "dbms_api.h"
 #include <apr_strings.h>
 #include "util.h" /* for format_time */
 
-dav_error *dbms_lookup_uri(apr_pool_t *pool, const dav_repos_db *d,
-                           const char *uri_from_root, const dbms_bind_list **p_bind)
+/* deepest path kept in bind_paths, see database/add_bind_paths.xml */
+#define DBMS_BIND_PATHS_MAX_DEPTH 32
+
+/**
+ * Resolves a URI from the bind cache alone
+ * @return 1 if every bind on the way was cached, 0 otherwise. The
+ * updated_at of a resolved bind leaves out the resource's lastmodified,
+ * which the caller has to fold in
+ */
+static int dbms_lookup_uri_cached(apr_pool_t *pool, const char *uri,
+                                  dbms_bind_list *bind)
+{
+    char *last = NULL, *next;
+    dbms_bind_cache_entry entry = { 0, 0, NULL };
+    long collection_id = ROOT_COLLECTION_ID;
+    const char *updated_at = "";
+
+    for (next = apr_strtok(apr_pstrdup(pool, uri), "/", &last);
+         next; next = apr_strtok(NULL, "/", &last)) {
+        if (!dbms_bind_cache_get(pool, collection_id, next, &entry))
+            return 0;
+        if (strcmp(entry.updated_at, updated_at) > 0)
+            updated_at = entry.updated_at;
+        collection_id = entry.resource_id;
+    }
+
+    bind->resource_id = entry.resource_id;
+    bind->bind_id = entry.bind_id;
+    bind->updated_at = (char *)updated_at;
+    return 1;
+}
+
+/* cache the first count binds of a lookup, as returned by dbms_lookup_uri */
+static void dbms_lookup_uri_fill_cache(apr_pool_t *pool, const char *uri,
+                                       apr_uint32_t generation,
+                                       char **dbrow, int i, int count)
+{
+    char *last = NULL, *next;
+    dbms_bind_cache_entry entry;
+    long collection_id = ROOT_COLLECTION_ID;
+    int k;
+
+    next = apr_strtok(apr_pstrdup(pool, uri), "/", &last);
+    for (k = 0; k < count && next; k++) {
+        entry.resource_id = atol(dbrow[k]);
+        entry.bind_id = atol(dbrow[i + 2 + 2 * k]);
+        entry.updated_at = dbrow[i + 3 + 2 * k];
+        dbms_bind_cache_put(generation, collection_id, next, &entry);
+
+        collection_id = entry.resource_id;
+        next = apr_strtok(NULL, "/", &last);
+    }
+}
+
+/**
+ * Resolves a URI by joining binds once for every segment
+ * @param generation - The bind cache generation read before the lookup
+ */
+static dav_error *dbms_lookup_uri_join(apr_pool_t *pool, const dav_repos_db *d,
+                                       char *uri, apr_uint32_t generation,
+                                       const dbms_bind_list **p_bind)
 {
-    char *uri = NULL;
     char *last = NULL, *next = NULL;
-    char *select, *from, *where, *uri_max_updated_at;
+    char *select, *from, *where, *uri_max_updated_at, *bind_cols;
     int i = 0, j = 0;
     char *query = NULL;
     dav_repos_query *q = NULL;
@@ -34,21 +93,11 @@ dav_error *dbms_lookup_uri(apr_pool_t *pool, const dav_repos_db *d,
     dbms_bind_list *bind = apr_pcalloc(pool, sizeof(*bind));
     dav_error *err = NULL;
 
-    TRACE();
-
-    /* Strip the root path from URI */
-    uri = compact_uri(pool, uri_from_root);
     next = apr_strtok(apr_pstrdup(pool, uri), "/", &last);
 
-    if(!next) {
-        bind->resource_id = ROOT_COLLECTION_ID;
-        bind->updated_at = ROOT_UPDATED_AT;
-        *p_bind = bind;
-        return NULL;
-    }
-
     i = i + 1;
     select = apr_psprintf(pool, "SELECT b1.resource_id"); 
+    bind_cols = apr_psprintf(pool, ", b1.id, b1.updated_at");
     uri_max_updated_at = apr_psprintf(pool, 
                                 "greatest(lastmodified, b1.updated_at");
     from = apr_psprintf(pool, "FROM binds b1 ");
@@ -64,6 +113,8 @@ dav_error *dbms_lookup_uri(apr_pool_t *pool, const dav_repos_db *d,
         select = apr_psprintf(pool, "%s, b%d.resource_id", select, i);
         uri_max_updated_at = apr_psprintf(pool, "%s, b%d.updated_at", 
                                           uri_max_updated_at, i);
+        bind_cols = apr_psprintf(pool, "%s, b%d.id, b%d.updated_at",
+                                 bind_cols, i, i);
         from = apr_psprintf(pool, "%sLEFT OUTER JOIN binds b%d "
                             "ON (b%d.resource_id = b%d.collection_id "
                             "AND b%d.name = '%s') ", 
@@ -77,7 +128,8 @@ dav_error *dbms_lookup_uri(apr_pool_t *pool, const dav_repos_db *d,
                    "%s) AS uri_max_updated_at, b%d.id ", 
                    uri_max_updated_at, i);
 
-    select = apr_pstrcat(pool, select, ", ", uri_max_updated_at, NULL);
+    select = apr_pstrcat(pool, select, ", ", uri_max_updated_at, bind_cols,
+                         " ", NULL);
     from = apr_psprintf(pool, 
                         "%sLEFT OUTER JOIN resources"
                         " ON resources.id = b%d.resource_id ", from, i);
@@ -102,6 +154,11 @@ dav_error *dbms_lookup_uri(apr_pool_t *pool, const dav_repos_db *d,
     while(dbrow[j][0] && j < i) { j++; }
     if (j != i)
         bind->resource_id = -1;
+
+    /* lookups inside a transaction may see an older snapshot than the
+     * generation read above, and a replica may lag behind it */
+    if (!dbms_api_in_transaction(d->db) && !dbms_api_is_replica(d->db))
+        dbms_lookup_uri_fill_cache(pool, uri, generation, dbrow, i, j);
     j = j - 1;
 
     if (bind->resource_id == -1) {
@@ -129,6 +186,170 @@ dav_error *dbms_lookup_uri(apr_pool_t *pool, const dav_repos_db *d,
     return err;
 }
 
+/**
+ * Resolves a URI with a single lookup of all its prefixes in bind_paths
+ * @param generation - The bind cache generation read before the lookup
+ * @param resolved - Set to 0 when bind_paths can't tell, for paths that are
+ * too deep, that go through a resource twice or whose rows are missing or
+ * stale, and binds must be walked
+ */
+static dav_error *dbms_lookup_uri_paths(apr_pool_t *pool,
+                                        const dav_repos_db *d,
+                                        const char *uri,
+                                        apr_uint32_t generation,
+                                        const dbms_bind_list **p_bind,
+                                        int *resolved)
+{
+    char *last = NULL, *next;
+    apr_array_header_t *names = apr_array_make(pool, 8, sizeof(char *));
+    apr_array_header_t *prefixes = apr_array_make(pool, 8, sizeof(char *));
+    char *prefix = "", *hashes = "", *paths = "", *query;
+    const char *esc;
+    dav_repos_query *q = NULL;
+    dbms_bind_cache_entry entry = { 0, 0, NULL };
+    long parent_id = ROOT_COLLECTION_ID, res_id = 0;
+    char *path = NULL, *path_updated_at = NULL, *uri_max_updated_at = NULL;
+    int fill_cache, ierrno = 0, n = 0;
+    dbms_bind_list *bind;
+    dav_error *err = NULL;
+
+    *resolved = 0;
+
+    for (next = apr_strtok(apr_pstrdup(pool, uri), "/", &last);
+         next; next = apr_strtok(NULL, "/", &last)) {
+        if (names->nelts == DBMS_BIND_PATHS_MAX_DEPTH)
+            return NULL;
+        APR_ARRAY_PUSH(names, char *) = next;
+        prefix = apr_pstrcat(pool, prefix, "/", next, NULL);
+        APR_ARRAY_PUSH(prefixes, char *) = prefix;
+        esc = dbms_escape(pool, d->db, prefix);
+        hashes = apr_psprintf(pool, "%s%sbind_path_hash('%s')", hashes,
+                              names->nelts > 1 ? ", " : "", esc);
+        paths = apr_psprintf(pool, "%s%s'%s'", paths,
+                             names->nelts > 1 ? ", " : "", esc);
+    }
+
+    /* the hash is what is indexed, full_path weeds out collisions */
+    query = apr_psprintf(pool,
+                         "SELECT bp.full_path, bp.resource_id, bp.bind_id, "
+                         "b.updated_at, bp.path_updated_at, "
+                         "greatest(r.lastmodified, bp.path_updated_at) "
+                         "FROM bind_paths bp "
+                         "INNER JOIN binds b ON b.id = bp.bind_id "
+                         "LEFT OUTER JOIN resources r "
+                         "ON r.id = bp.resource_id "
+                         "WHERE bp.path_hash IN (%s) "
+                         "AND bp.full_path IN (%s) "
+                         "ORDER BY length(bp.full_path)", hashes, paths);
+
+    q = dbms_prepare(pool, d->db, query);
+    if (dbms_execute(q)) {
+        dbms_query_destroy(q);
+        return dav_new_error(pool, HTTP_INTERNAL_SERVER_ERROR, 0,
+                             "dbms_execute error");
+    }
+
+    /* lookups inside a transaction may see an older snapshot than the
+     * generation read before, and a replica may lag behind it */
+    fill_cache = !dbms_api_in_transaction(d->db)
+      && !dbms_api_is_replica(d->db);
+
+    /* every prefix of a path in bind_paths is there too, so the rows are
+     * the binds from the root down to the deepest one found; a row that
+     * is not the next prefix means bind_paths is out of step with binds,
+     * which are walked instead */
+    while (n < names->nelts && (ierrno = dbms_next(q)) == 1) {
+        path = dbms_get_string(q, 1);
+        if (strcmp(path, APR_ARRAY_IDX(prefixes, n, char *))) {
+            dbms_query_destroy(q);
+            return NULL;
+        }
+        entry.resource_id = dbms_get_int(q, 2);
+        entry.bind_id = dbms_get_int(q, 3);
+        entry.updated_at = dbms_get_string(q, 4);
+        path_updated_at = dbms_get_string(q, 5);
+        uri_max_updated_at = dbms_get_string(q, 6);
+
+        if (fill_cache)
+            dbms_bind_cache_put(generation, parent_id,
+                                APR_ARRAY_IDX(names, n, char *), &entry);
+        parent_id = entry.resource_id;
+        n++;
+    }
+    dbms_query_destroy(q);
+
+    if (ierrno < 0)
+        return dav_new_error(pool, HTTP_INTERNAL_SERVER_ERROR, 0,
+                             "Error querying database");
+
+    if (n < names->nelts) {
+        /* a missing path that is there in binds was left out of bind_paths */
+        err = dbms_get_bind_resource_id(pool, d, parent_id,
+                                        APR_ARRAY_IDX(names, n, char *),
+                                        &res_id);
+        if (err || res_id)
+            return err;
+    }
+
+    *resolved = 1;
+    if (n == 0)
+        return NULL;
+
+    bind = apr_pcalloc(pool, sizeof(*bind));
+    if (n < names->nelts) {
+        bind->resource_id = -1;
+        bind->parent_id = parent_id;
+        bind->uri = path;
+        bind->updated_at = path_updated_at;
+    } else {
+        bind->resource_id = parent_id;
+        bind->bind_id = entry.bind_id;
+        bind->updated_at = uri_max_updated_at;
+    }
+
+    *p_bind = bind;
+    return NULL;
+}
+
+dav_error *dbms_lookup_uri(apr_pool_t *pool, const dav_repos_db *d,
+                           const char *uri_from_root, const dbms_bind_list **p_bind)
+{
+    char *uri = NULL;
+    char *last = NULL, *next = NULL;
+    dbms_bind_list *bind = apr_pcalloc(pool, sizeof(*bind));
+    dav_error *err = NULL;
+    apr_uint32_t generation;
+    int resolved = 0;
+
+    TRACE();
+
+    /* Strip the root path from URI */
+    uri = compact_uri(pool, uri_from_root);
+    next = apr_strtok(apr_pstrdup(pool, uri), "/", &last);
+
+    if(!next) {
+        bind->resource_id = ROOT_COLLECTION_ID;
+        bind->updated_at = ROOT_UPDATED_AT;
+        *p_bind = bind;
+        return NULL;
+    }
+
+    if (dbms_lookup_uri_cached(pool, uri, bind)) {
+        *p_bind = bind;
+        return NULL;
+    }
+
+    /* read before querying, so that a change committed in between leaves
+     * what we put into the cache stale right away */
+    generation = dbms_bind_cache_generation();
+
+    err = dbms_lookup_uri_paths(pool, d, uri, generation, p_bind, &resolved);
+    if (err || resolved)
+        return err;
+
+    return dbms_lookup_uri_join(pool, d, uri, generation, p_bind);
+}
+
 dav_error *dbms_get_collection_max_updated_at(apr_pool_t *pool,
                                               const dav_repos_db *d,
                                               long collection_id,
@@ -287,6 +508,7 @@ dav_error *dbms_delete_bind(apr_pool_t *pool, const dav_repos_db *d,
     dbms_set_int(q, 2, res_id);
     dbms_set_string(q, 3, bind_name);
 
+    dbms_bind_cache_invalidate();
     if (dbms_execute(q)) {
         dbms_query_destroy(q);
 	return dav_new_error(pool, HTTP_INTERNAL_SERVER_ERROR, 0, 
@@ -333,6 +555,7 @@ dav_error *dbms_insert_bind(apr_pool_t *pool, const dav_repos_db * db,
     dbms_set_int(q, 3, resource_id);
     dbms_set_string(q, 4, time_apr_to_str(pool, apr_time_now()));
     
+    dbms_bind_cache_invalidate();
     if (dbms_execute(q)) {
         db_error_message(pool, db->db, "dbms_execute error");
         err = dav_new_error(pool, HTTP_INTERNAL_SERVER_ERROR, 0, 
@@ -434,6 +657,7 @@ dav_error *dbms_insert_bind_list(apr_pool_t *pool, const dav_repos_db *d,
     }
 
     q = dbms_prepare(pool, d->db, query_str);
+    dbms_bind_cache_invalidate();
     if (dbms_execute(q)) {
         err = dav_new_error(pool, HTTP_INTERNAL_SERVER_ERROR, 0, 
                 "Could not insert into binds table.");
@@ -497,6 +721,7 @@ dav_error *dbms_rebind_resource(apr_pool_t *pool, const dav_repos_db *d,
     dbms_set_int(q, 4, src_parent_id);
     dbms_set_string(q, 5, src_bind_name);
     
+    dbms_bind_cache_invalidate();
     if (dbms_execute(q)) {
         dbms_query_destroy(q);
 	return dav_new_error(pool, HTTP_INTERNAL_SERVER_ERROR, 0, 
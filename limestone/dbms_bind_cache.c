@@ -0,0 +1,117 @@
+/* ====================================================================
+ * Copyright 2007 Lime Spot LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * ====================================================================
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <apr_strings.h>
+
+#include "dbms_bind_cache.h"
+#include "lru_cache.h"
+
+/* longest timestamp kept, anything longer is not cached */
+#define BIND_CACHE_TIME_LEN 40
+
+typedef struct {
+    dav_repos_lru_node lru;
+    long bind_id;
+    long resource_id;
+    char updated_at[BIND_CACHE_TIME_LEN];
+    char key[1];                    /* "collection_id/name" */
+} bind_node;
+
+/* bumped on every change to binds */
+static dav_repos_lru_cache cache =
+  DAV_REPOS_LRU_CACHE_INIT(cache, "dav_repos_bind_cache_shm");
+
+apr_status_t dbms_bind_cache_init(apr_pool_t *pproc)
+{
+    return dav_repos_lru_cache_init(&cache, pproc);
+}
+
+void dbms_bind_cache_child_init(apr_pool_t *pchild, int size,
+                                apr_interval_time_t ttl)
+{
+    if (size > 0)
+        dav_repos_lru_cache_child_init(&cache, pchild, size, ttl);
+}
+
+apr_uint32_t dbms_bind_cache_generation(void)
+{
+    return dav_repos_lru_cache_generation(&cache);
+}
+
+void dbms_bind_cache_invalidate(void)
+{
+    dav_repos_lru_cache_invalidate(&cache);
+}
+
+int dbms_bind_cache_get(apr_pool_t *pool, long collection_id,
+                        const char *name, dbms_bind_cache_entry *entry)
+{
+    bind_node *node;
+    char *key;
+
+    if (!dav_repos_lru_cache_enabled(&cache))
+        return 0;
+
+    key = apr_psprintf(pool, "%ld/%s", collection_id, name);
+    node = dav_repos_lru_cache_get(&cache, pool,
+                                   dav_repos_lru_cache_generation(&cache),
+                                   key, strlen(key));
+    if (node) {
+        entry->bind_id = node->bind_id;
+        entry->resource_id = node->resource_id;
+        entry->updated_at = node->updated_at;
+    }
+
+    return node != NULL;
+}
+
+void dbms_bind_cache_put(apr_uint32_t generation, long collection_id,
+                         const char *name, const dbms_bind_cache_entry *entry)
+{
+    char prefix[32];
+    apr_size_t plen, nlen;
+    bind_node *node;
+
+    if (!dav_repos_lru_cache_current(&cache, generation))
+        return;
+
+    if (entry->updated_at && strlen(entry->updated_at) >= BIND_CACHE_TIME_LEN)
+        return;
+
+    plen = apr_snprintf(prefix, sizeof(prefix), "%ld/", collection_id);
+    nlen = strlen(name);
+    node = malloc(sizeof(*node) + plen + nlen);
+    if (!node)
+        return;
+
+    node->bind_id = entry->bind_id;
+    node->resource_id = entry->resource_id;
+    apr_cpystrn(node->updated_at,
+                entry->updated_at ? entry->updated_at : "",
+                BIND_CACHE_TIME_LEN);
+    memcpy(node->key, prefix, plen);
+    memcpy(node->key + plen, name, nlen + 1);
+    node->lru.key = node->key;
+    node->lru.klen = plen + nlen;
+    node->lru.alloc = sizeof(*node) + plen + nlen;
+    node->lru.cost = 1;
+
+    dav_repos_lru_cache_put(&cache, generation, &node->lru);
+}
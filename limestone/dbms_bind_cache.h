@@ -0,0 +1,88 @@
+/* ====================================================================
+ * Copyright 2007 Lime Spot LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * ====================================================================
+ */
+
+#ifndef __DBMS_BIND_CACHE_H__
+#define __DBMS_BIND_CACHE_H__
+
+#include <apr_pools.h>
+#include <apr_time.h>
+
+/**
+ * Per-process LRU cache of binds, (collection_id, name) -> bind, used to
+ * resolve URIs without going to the database. Every change to the binds
+ * table bumps a generation counter shared by all processes of the server;
+ * entries filled under an older generation are never served. Changes made
+ * by other servers or in SQL do not bump it, so no entry is served for
+ * longer than the time to live either.
+ */
+
+typedef struct {
+    long bind_id;
+    long resource_id;
+    const char *updated_at;
+} dbms_bind_cache_entry;
+
+/**
+ * Sets up the shared generation counter, before the children are forked
+ * @param pproc - The process pool
+ * @return APR_SUCCESS, or why the counter is private to each process
+ */
+apr_status_t dbms_bind_cache_init(apr_pool_t *pproc);
+
+/**
+ * Sets up this process' cache
+ * @param pchild - The child's pool
+ * @param size - The most binds to hold, 0 to disable the cache
+ * @param ttl - How long a bind is served for
+ */
+void dbms_bind_cache_child_init(apr_pool_t *pchild, int size,
+                                apr_interval_time_t ttl);
+
+/**
+ * @return The current generation. Read it before querying the binds that
+ * are going to be put into the cache
+ */
+apr_uint32_t dbms_bind_cache_generation(void);
+
+/**
+ * Drops every cached bind, in this process and all others
+ */
+void dbms_bind_cache_invalidate(void);
+
+/**
+ * Looks up a bind
+ * @param pool - The pool to copy the entry into
+ * @param collection_id - The collection the bind is in
+ * @param name - The name of the bind
+ * @param entry - Filled in when found
+ * @return 1 if found, 0 if not
+ */
+int dbms_bind_cache_get(apr_pool_t *pool, long collection_id,
+                        const char *name, dbms_bind_cache_entry *entry);
+
+/**
+ * Remembers a bind
+ * @param generation - The generation read before the bind was queried
+ * @param collection_id - The collection the bind is in
+ * @param name - The name of the bind
+ * @param entry - The bind
+ */
+void dbms_bind_cache_put(apr_uint32_t generation, long collection_id,
+                         const char *name, const dbms_bind_cache_entry *entry);
+
+#endif /* __DBMS_BIND_CACHE_H__ */
@@ -17,7 +17,9 @@
  */
 
 #include <apr_strings.h>
-#include <unistd.h> /* for getpid */
+#include <apr_hash.h>
+#include <apr_reslist.h>
+#include <http_log.h>
 
 #include "dav_repos.h"
 
@@ -27,6 +29,296 @@
 static int query_count = 0;
 #endif
 
+/* A template is PREPAREd on the server the second time it is executed on
+ * a connection, so that one-off queries never pay for the extra round trip */
+#define DBMS_STMT_PREPARE_AFTER 1
+
+/* Upper bound on the number of templates tracked per connection */
+#define DBMS_STMT_CACHE_MAX 256
+
+/* A statement whose PREPARE failed for another reason than being refused
+ * is tried again after 1, 2, 4... more transactions, up to this many */
+#define DBMS_STMT_RETRY_MAX 1024
+
+/* Statement states */
+#define DBMS_STMT_NEW 0
+#define DBMS_STMT_PREPARED 1
+#define DBMS_STMT_FAILED 2
+
+#define DBMS_CONN_KEY "dav_repos_dbms_conn"
+
+typedef struct dbms_stmt {
+    const char *name;		/* server-side name of the statement */
+    int uses;			/* executions seen on this connection */
+    int state;			/* one of DBMS_STMT_* */
+    int retries;		/* PREPAREs that failed without being refused */
+    int retry_at;		/* transaction to try the PREPARE again in */
+} dbms_stmt;
+
+/* State that lives as long as the physical connection does */
+typedef struct dbms_conn {
+    apr_pool_t *pool;		/* the connection's pool */
+    int is_pgsql;		/* only PostgreSQL statements are cached */
+    apr_hash_t *stmts;		/* query template -> dbms_stmt */
+    int nstmts;
+    int ncursors;
+    apr_dbd_transaction_t *trans; /* open transaction, if any */
+    int session_ready;		/* session settings have been applied */
+    int read_only;		/* the open transaction is READ ONLY */
+    const char *pending;	/* statements to send ahead of the next query */
+    int epoch;			/* bumped by writes and transaction boundaries */
+    int xactions;		/* transactions begun */
+} dbms_conn;
+
+static dbms_conn *dbms_get_conn(const dav_repos_dbms *db)
+{
+    ap_dbd_t *dbd = db->ap_dbd_dbms;
+    dbms_conn *conn = NULL;
+
+    if (!dbd->pool)
+        return NULL;
+
+    apr_pool_userdata_get((void **)&conn, DBMS_CONN_KEY, dbd->pool);
+    if (!conn) {
+        conn = apr_pcalloc(dbd->pool, sizeof(*conn));
+        conn->pool = dbd->pool;
+        conn->is_pgsql = !strcmp(apr_dbd_name(dbd->driver), "pgsql");
+        conn->stmts = apr_hash_make(dbd->pool);
+        apr_pool_userdata_setn(conn, DBMS_CONN_KEY, NULL, dbd->pool);
+    }
+    return conn;
+}
+
+void dbms_dbd_set_transaction(const dav_repos_dbms *db,
+                              apr_dbd_transaction_t *trans)
+{
+    dbms_conn *conn = dbms_get_conn(db);
+    if (conn) {
+        conn->trans = trans;
+        conn->epoch++;
+        if (trans)
+            conn->xactions++;
+        else {
+            conn->pending = NULL;
+            conn->read_only = 0;
+        }
+    }
+}
+
+void dbms_dbd_set_read_only(const dav_repos_dbms *db, int read_only)
+{
+    dbms_conn *conn = dbms_get_conn(db);
+    if (conn)
+        conn->read_only = read_only;
+}
+
+int dbms_api_read_only(const dav_repos_dbms *db)
+{
+    dbms_conn *conn = dbms_get_conn(db);
+    return conn ? conn->read_only : 0;
+}
+
+int dbms_api_in_transaction(const dav_repos_dbms *db)
+{
+    dbms_conn *conn = dbms_get_conn(db);
+    return conn ? conn->trans != NULL : 0;
+}
+
+int dbms_api_epoch(const dav_repos_dbms *db)
+{
+    dbms_conn *conn = dbms_get_conn(db);
+    return conn ? conn->epoch : -1;
+}
+
+static apr_status_t dbms_clear_pending(void *data)
+{
+    dbms_conn *conn = data;
+    conn->pending = NULL;
+    return APR_SUCCESS;
+}
+
+int dbms_dbd_queue_statement(const dav_repos_dbms *db, const char *stmt)
+{
+    dbms_conn *conn = dbms_get_conn(db);
+
+    if (!conn || !conn->is_pgsql || !conn->trans || !db->rec)
+        return -1;
+
+    if (!conn->pending)
+        apr_pool_cleanup_register(db->rec->pool, conn, dbms_clear_pending,
+                                  apr_pool_cleanup_null);
+    conn->pending = apr_pstrcat(db->rec->pool,
+                                conn->pending ? conn->pending : "",
+                                stmt, "; ", NULL);
+    return 0;
+}
+
+int dbms_api_session_ready(const dav_repos_dbms *db)
+{
+    dbms_conn *conn = dbms_get_conn(db);
+    return conn ? conn->session_ready : 0;
+}
+
+void dbms_api_set_session_ready(const dav_repos_dbms *db)
+{
+    dbms_conn *conn = dbms_get_conn(db);
+    if (conn)
+        conn->session_ready = 1;
+}
+
+void dbms_api_set_tag(dav_repos_dbms *db, const char *tag)
+{
+    /* the tag must not be able to end the comment */
+    if (tag && !strstr(tag, "*/"))
+        db->tag = apr_pstrcat(db->rec ? db->rec->pool : db->ap_dbd_dbms->pool,
+                              "/* ", tag, " */ ", NULL);
+    else
+        db->tag = NULL;
+}
+
+/**
+ * Prepends the request's tag and any queued statements to a query, so
+ * that they reach the server in the same round trip
+ */
+static const char *dbms_decorate(dav_repos_query *query, const char *sql)
+{
+    dbms_conn *conn = dbms_get_conn(query->db);
+    const char *pending = conn ? conn->pending : NULL;
+
+    if (!pending && !query->db->tag)
+        return sql;
+
+    if (conn)
+        conn->pending = NULL;
+    return apr_pstrcat(query->pool, query->db->tag ? query->db->tag : "",
+                       pending ? pending : "", sql, NULL);
+}
+
+/**
+ * Tells whether the server refused to prepare a template for what it is,
+ * a syntax error or something not supported (SQLSTATE classes 42 and 0A),
+ * going by the message as apr_dbd hides the SQLSTATE. The message is lost
+ * when the PREPARE failed in a transaction, whose savepoint was rolled
+ * back since
+ */
+static int dbms_stmt_refused(const char *message)
+{
+    static const char *const refusals[] = {
+        "syntax error", "does not exist", "could not determine data type",
+        "is ambiguous", "must appear in the GROUP BY", "permission denied",
+        "not supported", "not implemented", NULL
+    };
+    int i;
+
+    for (i = 0; message && refusals[i]; i++)
+        if (strstr(message, refusals[i]))
+            return 1;
+    return 0;
+}
+
+/**
+ * Issues the PREPARE for a cached template. Parameter types are left for
+ * the server to infer, just as with the spliced literals of the text path.
+ * Any open transaction is switched to ignore errors for the duration, so
+ * a template the server refuses to prepare does not abort it.
+ * @return the new state of the statement: prepared, failed for good when
+ *   the server refused the template, or new again to be retried in a later
+ *   transaction when the PREPARE failed for another reason, such as the
+ *   transaction being aborted already
+ */
+static int dbms_stmt_prepare(dav_repos_query *query, dbms_conn *conn,
+                             dbms_stmt *stmt)
+{
+    ap_dbd_t *dbd = query->db->ap_dbd_dbms;
+    const char *s, *message;
+    char *sql, *p;
+    int n = 0, nrows, mode = 0, error;
+
+    p = sql = apr_palloc(query->pool, strlen(query->query_string)
+                         + query->param_count * 11 + strlen(stmt->name) + 16);
+    p += sprintf(p, "PREPARE %s AS ", stmt->name);
+    for (s = query->query_string; *s; s++) {
+        if (*s == '?')
+            p += sprintf(p, "$%d", ++n);
+        else
+            *p++ = *s;
+    }
+    *p = 0;
+
+    DBG1("Preparing: %s\n", sql);
+
+    /* PREPARE takes a snapshot, so the queued statements, SET TRANSACTION
+     * among them, have to reach the server before it does */
+    if (conn->pending) {
+        error = apr_dbd_query(dbd->driver, dbd->handle, &nrows,
+                              dbms_decorate(query, ""));
+        if (error) {
+            DBG2("Error Code %d returned by queued statements: %s\n", error,
+                 dbms_error(query->pool, query->db));
+            stmt->retry_at = conn->xactions + 1;
+            return DBMS_STMT_NEW;
+        }
+    }
+
+    if (conn->trans) {
+        mode = apr_dbd_transaction_mode_get(dbd->driver, conn->trans);
+        apr_dbd_transaction_mode_set(dbd->driver, conn->trans,
+                                     mode | APR_DBD_TRANSACTION_IGNORE_ERRORS);
+    }
+
+    error = apr_dbd_query(dbd->driver, dbd->handle, &nrows, sql);
+
+    if (conn->trans)
+        apr_dbd_transaction_mode_set(dbd->driver, conn->trans, mode);
+
+    if (!error)
+        return DBMS_STMT_PREPARED;
+
+    message = dbms_error(query->pool, query->db);
+    DBG2("Error Code %d returned preparing statement: %s\n", error, message);
+    if (dbms_stmt_refused(message))
+        return DBMS_STMT_FAILED;
+
+    stmt->retry_at = conn->xactions + (1 << stmt->retries);
+    if ((1 << stmt->retries) < DBMS_STMT_RETRY_MAX)
+        stmt->retries++;
+    return DBMS_STMT_NEW;
+}
+
+/**
+ * Looks up the server-side statement for a query's template
+ * @return the statement name, or NULL if the query should go down the
+ *   text path
+ */
+static const char *dbms_stmt_lookup(dav_repos_query *query)
+{
+    dbms_conn *conn;
+    dbms_stmt *stmt;
+
+    if (!query->cacheable)
+        return NULL;
+
+    conn = dbms_get_conn(query->db);
+    if (!conn || !conn->is_pgsql)
+        return NULL;
+
+    stmt = apr_hash_get(conn->stmts, query->query_string, APR_HASH_KEY_STRING);
+    if (!stmt) {
+        if (conn->nstmts >= DBMS_STMT_CACHE_MAX)
+            return NULL;
+        stmt = apr_pcalloc(conn->pool, sizeof(*stmt));
+        stmt->name = apr_psprintf(conn->pool, "dav_repos_%d", ++conn->nstmts);
+        apr_hash_set(conn->stmts, apr_pstrdup(conn->pool, query->query_string),
+                     APR_HASH_KEY_STRING, stmt);
+    }
+
+    if (stmt->state == DBMS_STMT_NEW && stmt->uses++ >= DBMS_STMT_PREPARE_AFTER
+        && conn->xactions >= stmt->retry_at)
+        stmt->state = dbms_stmt_prepare(query, conn, stmt);
+
+    return stmt->state == DBMS_STMT_PREPARED ? stmt->name : NULL;
+}
+
 dav_repos_dbms *dbms_api_opendb(apr_pool_t *pool, void *p)
 {
     dav_repos_dbms *db = apr_pcalloc(pool, sizeof(dav_repos_dbms));
@@ -53,15 +345,166 @@ dav_repos_dbms *dbms_api_opendb_params(apr_pool_t *pool,
     db->ap_dbd_dbms = apr_pcalloc(pool, sizeof(ap_dbd_t));
     db->ap_dbd_dbms->driver = dbd_driver;
     db->ap_dbd_dbms->handle = dbd_handle;
+    db->ap_dbd_dbms->pool = pool;
     db->apr_dbd = 1;
     return db;
 }
 
+/* Connections to a read replica, opened on demand by each child process */
+struct dbms_replica {
+    const apr_dbd_driver_t *driver;
+    const char *params;
+#if APR_HAS_THREADS
+    apr_reslist_t *reslist;
+#else
+    ap_dbd_t *rec;		/* the child's only replica connection */
+#endif
+};
+
+/* Each connection gets a pool of its own, so that state kept on it
+ * (see dbms_get_conn) goes away with the connection. The pool is not a
+ * child of the reslist's, which destroys its children before it runs the
+ * destructors that close connections */
+static apr_status_t dbms_replica_construct(void **data, void *params,
+                                           apr_pool_t *pool)
+{
+    dbms_replica *replica = params;
+    ap_dbd_t *rec;
+    apr_pool_t *rec_pool;
+    apr_status_t rv;
+
+    if ((rv = apr_pool_create(&rec_pool, NULL)) != APR_SUCCESS)
+        return rv;
+
+    rec = apr_pcalloc(rec_pool, sizeof(*rec));
+    rec->pool = rec_pool;
+    rec->driver = replica->driver;
+    rv = apr_dbd_open(replica->driver, rec_pool, replica->params,
+                      &rec->handle);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, NULL,
+                     "dbms_replica_construct: Error opening a replica "
+                     "connection");
+        apr_pool_destroy(rec_pool);
+        return rv;
+    }
+
+    *data = rec;
+    return APR_SUCCESS;
+}
+
+static apr_status_t dbms_replica_destruct(void *data, void *params,
+                                          apr_pool_t *pool)
+{
+    ap_dbd_t *rec = data;
+
+    apr_dbd_close(rec->driver, rec->handle);
+    apr_pool_destroy(rec->pool);
+    return APR_SUCCESS;
+}
+
+dbms_replica *dbms_api_replica_create(apr_pool_t *pool, const char *driver,
+                                      const char *params, int max)
+{
+    dbms_replica *replica = apr_pcalloc(pool, sizeof(*replica));
+
+    if (APR_SUCCESS != apr_dbd_get_driver(pool, driver, &replica->driver))
+        return NULL;
+    replica->params = apr_pstrdup(pool, params);
+
+#if APR_HAS_THREADS
+    if (APR_SUCCESS != apr_reslist_create(&replica->reslist, 0,
+                                          max, max, 0,
+                                          dbms_replica_construct,
+                                          dbms_replica_destruct,
+                                          replica, pool))
+        return NULL;
+#endif
+    return replica;
+}
+
+#if APR_HAS_THREADS
+static apr_status_t dbms_replica_release(void *data)
+{
+    dav_repos_dbms *db = data;
+    dbms_replica *replica = db->replica;
+
+    apr_reslist_release(replica->reslist, db->ap_dbd_dbms);
+    return APR_SUCCESS;
+}
+#endif
+
+dav_repos_dbms *dbms_api_opendb_replica(apr_pool_t *pool, request_rec *r,
+                                        dbms_replica *replica)
+{
+    dav_repos_dbms *db = apr_pcalloc(pool, sizeof(dav_repos_dbms));
+    ap_dbd_t *rec = NULL;
+
+#if APR_HAS_THREADS
+    if (APR_SUCCESS != apr_reslist_acquire(replica->reslist, (void **)&rec))
+        return NULL;
+
+    if (APR_SUCCESS != apr_dbd_check_conn(rec->driver, r->pool, rec->handle)) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r,
+                      "dbms_api_opendb_replica: dropping a broken replica "
+                      "connection");
+        apr_reslist_invalidate(replica->reslist, rec);
+        return NULL;
+    }
+
+    db->ap_dbd_dbms = rec;
+    db->replica = replica;
+    apr_pool_cleanup_register(r->pool, db, dbms_replica_release,
+                              apr_pool_cleanup_null);
+#else
+    if (replica->rec && APR_SUCCESS !=
+        apr_dbd_check_conn(replica->rec->driver, r->pool, replica->rec->handle)) {
+        dbms_replica_destruct(replica->rec, replica, NULL);
+        replica->rec = NULL;
+    }
+    if (!replica->rec && APR_SUCCESS !=
+        dbms_replica_construct((void **)&replica->rec, replica, NULL))
+        return NULL;
+
+    db->ap_dbd_dbms = replica->rec;
+    db->replica = replica;
+#endif
+    db->rec = r;
+    return db;
+}
+
+int dbms_api_is_replica(const dav_repos_dbms *db)
+{
+    return db->replica != NULL;
+}
+
+void dbms_api_set_trace(dav_repos_dbms *db, dbms_trace *trace)
+{
+    db->trace = trace;
+}
+
+void dbms_api_set_repeat_limits(dav_repos_dbms *db, int warn, int budget)
+{
+    db->repeat_warn = warn;
+    db->repeat_budget = budget;
+    db->exec_counts = (db->rec && (warn || budget)) ?
+      apr_hash_make(db->rec->pool) : NULL;
+}
+
+int dbms_api_over_budget(const dav_repos_dbms *db)
+{
+    return db->over_budget;
+}
+
 void dbms_api_closedb(dav_repos_dbms *dbms)
 {
     ap_dbd_t *db = dbms->ap_dbd_dbms;
     if (dbms->apr_dbd)
         apr_dbd_close(db->driver, db->handle);
+#if APR_HAS_THREADS
+    else if (dbms->replica)
+        apr_pool_cleanup_run(dbms->rec->pool, dbms, dbms_replica_release);
+#endif
 }
 
 const char *dbms_error(apr_pool_t * pool, const dav_repos_dbms * repos_db)
@@ -95,6 +538,7 @@ dav_repos_query *dbms_prepare(apr_pool_t * pool,
 	(char **) apr_pcalloc(pool, sizeof(char *) * q->param_count);
     for (i = 0; i < q->param_count; i++)
 	q->parameters[i] = NULL;
+    q->cacheable = q->param_count > 0;
 
 #ifdef DEBUG
     query_count++;
@@ -103,6 +547,15 @@ dav_repos_query *dbms_prepare(apr_pool_t * pool,
     return q;
 }
 
+dav_repos_query *dbms_prepare_dynamic(apr_pool_t * pool,
+                                      const dav_repos_dbms * dbms,
+                                      const char *query)
+{
+    dav_repos_query *q = dbms_prepare(pool, dbms, query);
+    q->cacheable = 0;
+    return q;
+}
+
 int dbms_set_int(dav_repos_query * query,
 		 const int num, const long value)
 {
@@ -150,11 +603,106 @@ const char *dbms_escape(apr_pool_t *pool, const dav_repos_dbms *db,
 
 }
 
-int dbms_execute(dav_repos_query * query)
+void dbms_dbd_note_error(const dav_repos_dbms *db, const char *message)
+{
+    if (!db->rec || !message)
+        return;
+
+    if (strstr(message, "could not serialize access"))
+        apr_table_setn(db->rec->notes, "xaction_error", "1");
+
+    /* a method taken to be read-only wrote after all; have it rerun in a
+     * read-write transaction */
+    if (strstr(message, "read-only transaction")) {
+        apr_table_setn(db->rec->notes, "xaction_error", "1");
+        apr_table_setn(db->rec->notes, "xaction_read_write", "1");
+    }
+}
+
+static int dbms_query_failed(dav_repos_query *query, const char *func,
+                             int error)
+{
+    const char *message = dbms_error(query->pool, query->db);
+    DBG3("Error Code %d returned in %s: %s", error, func, message);
+    dbms_dbd_note_error(query->db, message);
+
+    query->state = DAV_REPOS_STATE_ERROR;
+    return error;
+}
+
+/**
+ * Fetches the next batch of rows from a query's cursor, releasing the
+ * previous batch
+ */
+static int dbms_fetch_batch(dav_repos_query *query)
+{
+    ap_dbd_t *dbd = query->db->ap_dbd_dbms;
+    int nrows, error;
+
+    apr_pool_clear(query->batch_pool);
+    query->results = NULL;
+    query->row = NULL;
+
+    error = apr_dbd_select(dbd->driver, query->batch_pool, dbd->handle,
+                           &(query->results),
+                           apr_psprintf(query->batch_pool, "FETCH %d FROM %s",
+                                        query->fetch_size, query->cursor), 1);
+    if (error)
+        return dbms_query_failed(query, "apr_dbd_select", error);
+
+    query->colcount = apr_dbd_num_cols(dbd->driver, query->results);
+    nrows = apr_dbd_num_tuples(dbd->driver, query->results);
+    if (query->trace_rec)
+        query->trace_rec->nrows += nrows;
+    if (nrows < query->fetch_size)
+        query->last_batch = 1;
+    return 0;
+}
+
+/**
+ * Runs a SELECT through a server-side cursor, so that only fetch_size rows
+ * are held in memory at a time. Cursors only live inside a transaction.
+ */
+static int dbms_open_cursor(dav_repos_query *query, dbms_conn *conn,
+                            const char *escquery)
+{
+    ap_dbd_t *dbd = query->db->ap_dbd_dbms;
+    const char *cursor;
+    int nrows, error;
+
+    cursor = apr_psprintf(query->pool, "dav_repos_cur_%d", ++conn->ncursors);
+    error = apr_dbd_query(dbd->driver, dbd->handle, &nrows,
+                          dbms_decorate(query, apr_pstrcat
+                                        (query->pool, "DECLARE ", cursor,
+                                         " NO SCROLL CURSOR FOR ", escquery,
+                                         NULL)));
+    if (error)
+        return dbms_query_failed(query, "apr_dbd_query", error);
+
+    query->is_select = 1;
+    query->cursor = cursor;
+    query->last_batch = 0;
+    if (!query->batch_pool)
+        apr_pool_create(&(query->batch_pool), query->pool);
+    query->state = DAV_REPOS_STATE_EXECUTED;
+
+    return dbms_fetch_batch(query);
+}
+
+int dbms_set_fetch_size(dav_repos_query *query, int fetch_size)
+{
+    query->fetch_size = fetch_size > 0 ? fetch_size : 0;
+    return 0;
+}
+
+static int dbms_run(dav_repos_query * query)
 {
     int full_length, query_string_length;
     int i, j, k, error;
-    char *escquery;
+    const char *escquery;
+    char *spliced;
+    const char *stmt_name = NULL;
+    dbms_conn *conn = NULL;
 
     full_length = query_string_length = strlen(query->query_string);
 
@@ -166,42 +714,57 @@ int dbms_execute(dav_repos_query * query)
 
     if (query->param_count == 0) {
         escquery = apr_pstrdup(query->pool, query->query_string);
+    } else if (!query->fetch_size && (stmt_name = dbms_stmt_lookup(query))) {
+        /* the escaped literals are coerced to the prepared parameter types */
+        escquery = apr_pstrcat(query->pool, "EXECUTE ", stmt_name, "(", NULL);
+        for (i = 0; i < query->param_count; i++)
+            escquery = apr_pstrcat(query->pool, escquery, i ? ", " : "",
+                                   query->parameters[i], NULL);
+        escquery = apr_pstrcat(query->pool, escquery, ")", NULL);
     } else {
 
         /* make space for the trailing '\0' */
-        escquery = apr_pcalloc(query->pool, full_length + 1);
+        spliced = apr_pcalloc(query->pool, full_length + 1);
 
         for (i = 0, j = 0, k = 0; i < query_string_length; i++) {
 
             if (query->query_string[i] == '?') {
-                strcpy(escquery + j, query->parameters[k]);
+                strcpy(spliced + j, query->parameters[k]);
                 j += strlen(query->parameters[k++]);
             } else {
-                escquery[j++] = query->query_string[i];
+                spliced[j++] = query->query_string[i];
             }
         }
-        escquery[j] = 0;
+        spliced[j] = 0;
+        escquery = spliced;
+    }
+
+    if (query->fetch_size
+        && (!strncasecmp("select", query->query_string, 6)
+            || !strncasecmp("with", query->query_string, 4))
+        && (conn = dbms_get_conn(query->db)) && conn->is_pgsql && conn->trans)
+        return dbms_open_cursor(query, conn, escquery);
+
+    /* anything but a plain read may change what earlier reads returned */
+    if ((strncasecmp("select", query->query_string, 6)
+         && strncasecmp("with", query->query_string, 4))
+        || strstr(query->query_string, " RETURNING ")) {
+        if ((conn = dbms_get_conn(query->db)))
+            conn->epoch++;
     }
 
-    //DBG2("[%d]Query to execute: %s\n", getpid(), escquery);
-    DBG1("Query to execute: %s\n", escquery);
+    escquery = dbms_decorate(query, escquery);
 
-    if (!strncasecmp("select", escquery, 6) || !strncasecmp("with", escquery, 4) 
-        || strstr(escquery, " RETURNING ")) {
+    if (!strncasecmp("select", query->query_string, 6)
+        || !strncasecmp("with", query->query_string, 4)
+        || strstr(query->query_string, " RETURNING ")) {
         query->is_select = 1;
         error =
           apr_dbd_select(query->db->ap_dbd_dbms->driver, query->pool,
                          query->db->ap_dbd_dbms->handle, &(query->results),
                          escquery, 1);
-        if (error) {
-            const char *message = dbms_error(query->pool, query->db);
-            DBG2("Error Code %d returned in apr_dbd_select: %s", error, message);
-            if (query->db->rec && strstr(message, "could not serialize access"))
-                apr_table_setn(query->db->rec->notes, "xaction_error", "1");
-
-            query->state = DAV_REPOS_STATE_ERROR;
-            return error;
-        }
+        if (error)
+            return dbms_query_failed(query, "apr_dbd_select", error);
 
         query->colcount =
           apr_dbd_num_cols(query->db->ap_dbd_dbms->driver, query->results);
@@ -210,21 +773,84 @@ int dbms_execute(dav_repos_query * query)
           apr_dbd_query(query->db->ap_dbd_dbms->driver, 
                         query->db->ap_dbd_dbms->handle,
                         &(query->nrows), escquery);
-        if (error) {
-            const char *message = dbms_error(query->pool, query->db);
-            DBG2("Error Code %d returned in apr_dbd_query: %s", error, message);
-            if (query->db->rec && strstr(message, "could not serialize access"))
-                apr_table_setn(query->db->rec->notes, "xaction_error", "1");
-
-            query->state = DAV_REPOS_STATE_ERROR;
-            return error;
-        }
+        if (error)
+            return dbms_query_failed(query, "apr_dbd_query", error);
     }
 
     query->state = DAV_REPOS_STATE_EXECUTED;
     return 0;
 }
 
+/**
+ * Counts an execution of the query's template in this request
+ * @return 0 if the query may run, -1 if it is over the request's budget
+ */
+static int dbms_count_execution(dav_repos_query *query, const char *caller)
+{
+    dav_repos_dbms *db = query->db;
+    request_rec *r = db->rec;
+    int *count;
+
+    count = apr_hash_get(db->exec_counts, query->query_string,
+                         APR_HASH_KEY_STRING);
+    if (!count) {
+        count = apr_pcalloc(r->pool, sizeof(*count));
+        apr_hash_set(db->exec_counts, apr_pstrdup(r->pool, query->query_string),
+                     APR_HASH_KEY_STRING, count);
+    }
+    (*count)++;
+
+    if (db->repeat_warn && *count == db->repeat_warn + 1) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r,
+                      "query from %s ran more than %d times in one request: "
+                      "%s", caller, db->repeat_warn, query->query_string);
+        apr_table_setn(r->notes, "dav_repos_repeated_query",
+                       apr_pstrdup(r->pool, caller));
+    }
+
+    if (db->repeat_budget && *count > db->repeat_budget) {
+        if (*count == db->repeat_budget + 1)
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r,
+                          "query from %s exceeded its budget of %d runs "
+                          "per request: %s", caller, db->repeat_budget,
+                          query->query_string);
+        db->over_budget = 1;
+        return -1;
+    }
+    return 0;
+}
+
+int dbms_execute_at(dav_repos_query * query, const char *caller)
+{
+    dbms_trace_record *rec;
+    apr_time_t start;
+    int error;
+
+    if (query->db->exec_counts && dbms_count_execution(query, caller)) {
+        query->state = DAV_REPOS_STATE_ERROR;
+        return -1;
+    }
+
+    query->trace_rec = NULL;
+    if (!query->db->trace)
+        return dbms_run(query);
+
+    query->trace_rec = rec = dbms_trace_add(query->db->trace,
+                                            query->query_string, caller,
+                                            query->param_count);
+    start = apr_time_now();
+    error = dbms_run(query);
+    rec->elapsed = apr_time_now() - start;
+    rec->error = error;
+
+    /* rows of a cursor are counted as they are fetched */
+    if (!error && !query->cursor)
+        rec->nrows = query->is_select ?
+          apr_dbd_num_tuples(query->db->ap_dbd_dbms->driver, query->results)
+          : query->nrows;
+    return error;
+}
+
 /**
  * Return the number of rows affected
  * For SELECT queries this will be zero
@@ -235,11 +861,27 @@ int dbms_nrows(dav_repos_query *query) {
 
 int dbms_next(dav_repos_query * query)
 {
-    int errno;
+    int errno, ierrno;
 
     if (query->state != DAV_REPOS_STATE_EXECUTED || !query->results)
 	return -1;
 
+    if (query->cursor) {
+        while ((errno = apr_dbd_get_row(query->db->ap_dbd_dbms->driver,
+                                        query->batch_pool, query->results,
+                                        &(query->row), -1)) == -1) {
+            apr_time_t start = apr_time_now();
+            if (query->last_batch)
+                return 0;
+            ierrno = dbms_fetch_batch(query);
+            if (query->trace_rec)
+                query->trace_rec->elapsed += apr_time_now() - start;
+            if (ierrno)
+                return -1;
+        }
+        return errno ? -1 : 1;
+    }
+
     errno =
 	apr_dbd_get_row(query->db->ap_dbd_dbms->driver, query->pool, query->results,
 			&(query->row), -1);
@@ -271,8 +913,30 @@ char *dbms_get_string(dav_repos_query * query, int column)
 					 column - 1));
 }
 
+char **dbms_get_row(dav_repos_query * query, apr_pool_t * pool)
+{
+    char **dbrow;
+    int i;
+
+    if (!query->row)
+        return NULL;
+
+    dbrow = (char **) apr_pcalloc(pool, query->colcount * sizeof(char *));
+    for (i = 0; i < query->colcount; i++)
+        dbrow[i] =
+          apr_pstrdup(pool, apr_dbd_get_entry(query->db->ap_dbd_dbms->driver,
+                                              query->row, i));
+    return dbrow;
+}
+
 int dbms_query_destroy(dav_repos_query * query)
 {
+    if (query->cursor && query->state == DAV_REPOS_STATE_EXECUTED) {
+        int nrows;
+        apr_dbd_query(query->db->ap_dbd_dbms->driver,
+                      query->db->ap_dbd_dbms->handle, &nrows,
+                      apr_pstrcat(query->pool, "CLOSE ", query->cursor, NULL));
+    }
     apr_pool_destroy(query->pool);
 #ifdef DEBUG
     query_count--;
@@ -323,5 +987,7 @@ char **dbms_fetch_row_num(const dav_repos_dbms * db,
 
 int dbms_results_count(dav_repos_query* q)
 {
+    if (q->cursor)
+        return -1;
     return apr_dbd_num_tuples(q->db->ap_dbd_dbms->driver, q->results);
 }
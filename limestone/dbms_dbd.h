@@ -40,6 +40,16 @@ struct dav_repos_dbms {
     ap_dbd_t *ap_dbd_dbms;
     request_rec *rec;
     int apr_dbd;
+    dbms_replica *replica;	/* the replica the connection came from */
+    dbms_trace *trace;		/* NULL unless the request is traced */
+    const char *tag;		/* comment prepended to every statement */
+
+    /* executions of each query template in this request, NULL when
+     * neither of the limits below is set */
+    apr_hash_t *exec_counts;
+    int repeat_warn;		/* warn when a template runs more often */
+    int repeat_budget;		/* fail statements beyond this many runs */
+    int over_budget;		/* a statement was failed for the budget */
 };
 
 struct dav_repos_query {
@@ -55,6 +65,14 @@ struct dav_repos_query {
     char **parameters;		/* parameters set by dbms_set_ functions */
     short int *parameter_type;	/* one of DAV_REPOS_TYPE_* corresponding to each parameter */
     int param_count;		/* total number of parameters */
+    int cacheable;		/* may be run as a server-side prepared stmt */
+
+    int fetch_size;		/* rows per cursor fetch, 0 to buffer all */
+    const char *cursor;		/* name of the open cursor, if streaming */
+    apr_pool_t *batch_pool;	/* holds the current batch of cursor rows */
+    int last_batch;		/* the cursor has no rows beyond this batch */
+
+    dbms_trace_record *trace_rec; /* trace record of the last execution */
 
     apr_dbd_results_t *results; /* results returned after executionn */
     int colcount;		/* number of columns */
@@ -62,4 +80,37 @@ struct dav_repos_query {
     apr_dbd_row_t *row;		/* current row of results */
 };
 
+/**
+ * Records the transaction currently open on the connection behind db, so
+ * that statement preparation can be isolated from it.
+ * @param db - handle to the database
+ * @param trans - the open transaction, NULL once it has ended
+ */
+void dbms_dbd_set_transaction(const dav_repos_dbms *db,
+                              apr_dbd_transaction_t *trans);
+
+/**
+ * Records whether the open transaction on db's connection is READ ONLY
+ * @param db - handle to the database
+ * @param read_only - 1 if it is
+ */
+void dbms_dbd_set_read_only(const dav_repos_dbms *db, int read_only);
+
+/**
+ * Flags the request behind db for a retry if message reports a
+ * serialization failure
+ * @param db - handle to the database
+ * @param message - the error message from the driver
+ */
+void dbms_dbd_note_error(const dav_repos_dbms *db, const char *message);
+
+/**
+ * Queues a statement to be sent in the same round trip as the next query
+ * of the open transaction on the connection behind db
+ * @param db - handle to the database
+ * @param stmt - the statement, without a trailing semicolon
+ * @return 0 if queued, -1 if the statement must be executed directly
+ */
+int dbms_dbd_queue_statement(const dav_repos_dbms *db, const char *stmt);
+
 #endif				/* DBMS_DBD_H */
@@ -21,6 +21,7 @@
 #include "apr_strings.h"
 #include "deltav_util.h"        /* for mk_version_uri */
 #include "bridge.h"             /* for sabridge_new_dbr_from_dbr */
+#include "dbms_bind_cache.h"    /* for dbms_bind_cache_invalidate */
 
 static dav_error *dbms_get_creator_displayname(const dav_repos_db *d, 
                                                dav_repos_resource *r)
@@ -658,6 +659,8 @@ dav_error *dbms_restore_vcc(const dav_repos_db *db,
     apr_pool_t *pool = vcc->p;
     dav_repos_query *q = NULL;
 
+    dbms_bind_cache_invalidate();
+
     /* delete all version controlled binds of the vcc */
     q = dbms_prepare(pool, db->db,
                      "DELETE FROM binds "
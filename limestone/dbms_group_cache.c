@@ -0,0 +1,95 @@
+/* ====================================================================
+ * Copyright 2007 Lime Spot LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * ====================================================================
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dbms_group_cache.h"
+#include "lru_cache.h"
+
+typedef struct {
+    dav_repos_lru_node lru;
+    long principal_id;
+    int nids;
+    long ids[1];
+} group_node;
+
+/* bumped on every change to group memberships */
+static dav_repos_lru_cache cache =
+  DAV_REPOS_LRU_CACHE_INIT(cache, "dav_repos_group_cache_shm");
+
+apr_status_t dbms_group_cache_init(apr_pool_t *pproc)
+{
+    return dav_repos_lru_cache_init(&cache, pproc);
+}
+
+void dbms_group_cache_child_init(apr_pool_t *pchild, int size,
+                                 apr_interval_time_t ttl)
+{
+    if (size > 0)
+        dav_repos_lru_cache_child_init(&cache, pchild, size, ttl);
+}
+
+apr_uint32_t dbms_group_cache_generation(void)
+{
+    return dav_repos_lru_cache_generation(&cache);
+}
+
+void dbms_group_cache_invalidate(void)
+{
+    dav_repos_lru_cache_invalidate(&cache);
+}
+
+long *dbms_group_cache_get(apr_pool_t *pool, apr_uint32_t generation,
+                           long principal_id, int *nids)
+{
+    group_node *node = dav_repos_lru_cache_get(&cache, pool, generation,
+                                               &principal_id, sizeof(long));
+
+    if (!node)
+        return NULL;
+
+    *nids = node->nids;
+    return node->ids;
+}
+
+void dbms_group_cache_put(apr_uint32_t generation, long principal_id,
+                          const long *ids, int nids)
+{
+    group_node *node;
+    apr_size_t alloc;
+
+    /* a closure always has the principal itself */
+    if (nids < 1 || !dav_repos_lru_cache_current(&cache, generation))
+        return;
+
+    alloc = sizeof(*node) + (nids - 1) * sizeof(long);
+    node = malloc(alloc);
+    if (!node)
+        return;
+
+    node->principal_id = principal_id;
+    node->nids = nids;
+    memcpy(node->ids, ids, nids * sizeof(long));
+    node->lru.key = &node->principal_id;
+    node->lru.klen = sizeof(long);
+    node->lru.alloc = alloc;
+    node->lru.cost = 1;
+
+    dav_repos_lru_cache_put(&cache, generation, &node->lru);
+}
@@ -0,0 +1,81 @@
+/* ====================================================================
+ * Copyright 2007 Lime Spot LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * ====================================================================
+ */
+
+#ifndef __DBMS_GROUP_CACHE_H__
+#define __DBMS_GROUP_CACHE_H__
+
+#include <apr_pools.h>
+#include <apr_time.h>
+
+/**
+ * Per-process LRU cache of group closures, principal id -> the principal
+ * and every group it is in transitively, sorted. Every change to group
+ * memberships bumps a generation counter shared by all processes of the
+ * server; entries filled under an older generation are never served, and
+ * no entry is served for longer than the time to live.
+ */
+
+/**
+ * Sets up the shared generation counter, before the children are forked
+ * @param pproc - The process pool
+ * @return APR_SUCCESS, or why the counter is private to each process
+ */
+apr_status_t dbms_group_cache_init(apr_pool_t *pproc);
+
+/**
+ * Sets up this process' cache
+ * @param pchild - The child's pool
+ * @param size - The most closures to hold, 0 to disable the cache
+ * @param ttl - How long a closure is served for
+ */
+void dbms_group_cache_child_init(apr_pool_t *pchild, int size,
+                                 apr_interval_time_t ttl);
+
+/**
+ * @return The current generation. Read it before the request reads
+ * anything that is going to be put into the cache
+ */
+apr_uint32_t dbms_group_cache_generation(void);
+
+/**
+ * Drops every cached closure, in this process and all others
+ */
+void dbms_group_cache_invalidate(void);
+
+/**
+ * Looks up the closure of a principal
+ * @param pool - The pool to copy the closure into
+ * @param generation - The generation the caller read its data under
+ * @param principal_id - The principal
+ * @param nids - Set to the number of ids
+ * @return A copy of the ids, NULL if not found
+ */
+long *dbms_group_cache_get(apr_pool_t *pool, apr_uint32_t generation,
+                           long principal_id, int *nids);
+
+/**
+ * Remembers the closure of a principal
+ * @param generation - The generation read before the closure was queried
+ * @param principal_id - The principal
+ * @param ids - The principal and its groups, sorted
+ * @param nids - The number of ids
+ */
+void dbms_group_cache_put(apr_uint32_t generation, long principal_id,
+                          const long *ids, int nids);
+
+#endif /* __DBMS_GROUP_CACHE_H__ */
@@ -19,6 +19,7 @@
 #include "dbms_locks.h"
 #include "dbms_api.h"
 #include "util.h"
+#include "dbms_bind_cache.h" /* for dbms_bind_cache_invalidate */
 
 #define APR_WANT_MEMFUNC
 #include <apr_want.h>
@@ -110,7 +111,9 @@ dav_error *dbms_get_locks_by_where_str(dav_lockdb *lockdb,
     dbms_query_destroy(q);
     *locks = dummy_link_head->next;
 
-    if (exp_lids) dbms_delete_exp_locks(lockdb, exp_lids);
+    /* expired locks are left for the next writer to clean up */
+    if (exp_lids && !dbms_api_read_only(db->db))
+        dbms_delete_exp_locks(lockdb, exp_lids);
     return NULL;
 }
 
@@ -129,7 +132,7 @@ dav_error *dbms_delete_exp_locks(dav_lockdb *lockdb, const char *exp_lock_ids)
       apr_psprintf(pool, "SELECT id FROM resources WHERE id IN "
                    "(SELECT resource_id FROM locks WHERE locks.id IN (%s)) "
                    " AND type = ? ", exp_lock_ids);
-    q = dbms_prepare(pool, d->db, query_str);
+    q = dbms_prepare_dynamic(pool, d->db, query_str);
     dbms_set_string(q, 1, dav_repos_resource_types[dav_repos_LOCKNULL]);
 
     if (dbms_execute(q))
@@ -162,6 +165,8 @@ dav_error *dbms_delete_exp_locks(dav_lockdb *lockdb, const char *exp_lock_ids)
            exp_locknull_ids, exp_locknull_ids);
 
         q = dbms_prepare(pool, d->db, query_str);
+        /* takes the lock-null binds along */
+        dbms_bind_cache_invalidate();
         if (dbms_execute(q))
             err = dav_new_error(pool, HTTP_INTERNAL_SERVER_ERROR, 0,
                                 "DBMS Error retrieving locks");
@@ -21,6 +21,8 @@
 #include "dbms_api.h"
 #include "bridge.h"             /* for sabridge_new_dbr_from_dbr */
 #include "acl.h"
+#include "dbms_group_cache.h"
+#include <stdlib.h>             /* for qsort */
 
 #define DB_INSERT_USERS_INVALID_EMAIL "ERROR:  new row for relation \"users\" violates check constraint \"users_email_valid_check\"\n"
 
@@ -500,6 +502,78 @@ int dbms_will_loop_prin_add_grp(apr_pool_t *pool, const dav_repos_db *d,
     return result;
 }
 
+int dbms_compare_ids(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+    return x < y ? -1 : x > y;
+}
+
+dav_error *dbms_get_principal_groups(apr_pool_t *pool, const dav_repos_db *d,
+                                     long principal_id,
+                                     apr_array_header_t **groups)
+{
+    dav_repos_query *q = NULL;
+    apr_array_header_t *ids;
+    long *cached;
+    int ierrno, n;
+
+    TRACE();
+
+    if ((cached = dbms_group_cache_get(pool, d->group_generation,
+                                       principal_id, &n))) {
+        ids = apr_array_make(pool, n, sizeof(long));
+        memcpy(ids->elts, cached, n * sizeof(long));
+        ids->nelts = n;
+        *groups = ids;
+        return NULL;
+    }
+
+    q = dbms_prepare(pool, d->db,
+                     "SELECT transitive_group_id FROM transitive_group_members"
+                     " WHERE transitive_member_id = ?");
+    dbms_set_int(q, 1, principal_id);
+    if (dbms_execute(q)) {
+        dbms_query_destroy(q);
+        return dav_new_error(pool, HTTP_INTERNAL_SERVER_ERROR, 0,
+                             "Couldn't get the groups of a principal");
+    }
+
+    ids = apr_array_make(pool, 16, sizeof(long));
+    APR_ARRAY_PUSH(ids, long) = principal_id;
+    while ((ierrno = dbms_next(q)) == 1)
+        APR_ARRAY_PUSH(ids, long) = dbms_get_int(q, 1);
+    dbms_query_destroy(q);
+    if (ierrno < 0)
+        return dav_new_error(pool, HTTP_INTERNAL_SERVER_ERROR, 0,
+                             "Couldn't get the groups of a principal");
+
+    qsort(ids->elts, ids->nelts, sizeof(long), dbms_compare_ids);
+
+    /* a transaction that may write can see memberships of its own making,
+     * and a replica may lag behind the generation */
+    if ((!dbms_api_in_transaction(d->db) || dbms_api_read_only(d->db))
+        && !dbms_api_is_replica(d->db))
+        dbms_group_cache_put(d->group_generation, principal_id,
+                             (long *)ids->elts, ids->nelts);
+
+    *groups = ids;
+    return NULL;
+}
+
+const char *dbms_principal_groups_array(apr_pool_t *pool,
+                                        const apr_array_header_t *groups)
+{
+    apr_array_header_t *strs = apr_array_make(pool, groups->nelts + 1,
+                                              sizeof(char *));
+    int i;
+
+    for (i = 0; i < groups->nelts; i++)
+        APR_ARRAY_PUSH(strs, char *) =
+          apr_ltoa(pool, APR_ARRAY_IDX(groups, i, long));
+    return apr_pstrcat(pool, "{", apr_array_pstrcat(pool, strs, ','), "}",
+                       NULL);
+}
+
 dav_error *dbms_add_prin_to_grp_xitively(apr_pool_t *pool, 
                                          const dav_repos_db *d,
                                          long grp_id, long prin_id)
@@ -520,6 +594,9 @@ dav_error *dbms_add_prin_to_grp_xitively(apr_pool_t *pool,
 
     TRACE();
 
+    /* the group closures of the members change */
+    dbms_group_cache_invalidate();
+
     /* Add the children of grpA to all the parents of grpB */
 
 #define QUERY(SUBS)        "UPDATE transitive_group_members "           \
@@ -631,6 +708,9 @@ dav_error *dbms_rem_prin_frm_grp_xitively(apr_pool_t *pool,
        if any of the counts become zero, remove those entries */
     TRACE();
 
+    /* the group closures of the members change */
+    dbms_group_cache_invalidate();
+
     q = dbms_prepare
       (pool, d->db,
        "UPDATE transitive_group_members "
@@ -851,7 +931,7 @@ dav_error *dbms_calculate_group_changes(const dav_repos_db *db,
        "                ON principals.resource_id = cur_members.member_id "
        "    LEFT OUTER JOIN resources ON principals.resource_id = resources.id "
        "                      OR cur_members.member_id=resources.id ", NULL);
-    q = dbms_prepare(pool, db->db, query);
+    q = dbms_prepare_dynamic(pool, db->db, query);
     dbms_set_int(q, 1, group_dbr->serialno);
     if (dbms_execute(q))
         err = dav_new_error(pool, HTTP_INTERNAL_SERVER_ERROR, 0,
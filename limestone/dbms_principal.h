@@ -66,6 +66,36 @@ int dbms_will_loop_prin_add_grp(apr_pool_t *pool, const dav_repos_db *d,
 dav_error *dbms_add_prin_to_group(apr_pool_t *pool, const dav_repos_db *d,
                                   long group_id, long principal_id);
 
+/**
+ * Get the groups a principal is in, transitively, through the group cache
+ * @param pool the pool to allocate from
+ * @param d database handle
+ * @param principal_id the principal
+ * @param groups set to the ids of the principal and its groups, sorted
+ * @return NULL for success, dav_error otherwise
+ */
+dav_error *dbms_get_principal_groups(apr_pool_t *pool, const dav_repos_db *d,
+                                     long principal_id,
+                                     apr_array_header_t **groups);
+
+/**
+ * Compare two ids, to sort and search closures as from
+ * dbms_get_principal_groups
+ * @param a the first id, a long
+ * @param b the second id, a long
+ * @return less than, equal to or greater than 0 as a is to b
+ */
+int dbms_compare_ids(const void *a, const void *b);
+
+/**
+ * Format ids as a PostgreSQL array, to be bound to ANY(CAST(? AS BIGINT[]))
+ * @param pool the pool to allocate from
+ * @param groups the ids, such as from dbms_get_principal_groups
+ * @return the array literal, "{1,2,3}"
+ */
+const char *dbms_principal_groups_array(apr_pool_t *pool,
+                                        const apr_array_header_t *groups);
+
 dav_error *dbms_add_prin_to_grp_xitively(apr_pool_t *pool, 
                                          const dav_repos_db *d,
                                          long grp_id, long prin_id);
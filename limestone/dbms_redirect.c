@@ -87,7 +87,7 @@ dav_error *dbms_update_redirectref(const dav_repos_db *d,
     query = apr_pstrcat(r->p, query, 
                         ", updated_at = ? WHERE resource_id = ?", NULL);
 
-    q = dbms_prepare(r->p, d->db, query);
+    q = dbms_prepare_dynamic(r->p, d->db, query);
     dbms_set_string(q, 1, time_apr_to_str(r->p, apr_time_now()));
     dbms_set_int(q, 2, r->serialno);
 
@@ -0,0 +1,84 @@
+/* ====================================================================
+ * Copyright 2007 Lime Spot LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * ====================================================================
+ */
+
+#include <httpd.h>
+#include <http_log.h>
+#include <apr_atomic.h>
+#include <apr_strings.h>
+
+#include "dbms_trace.h"
+
+/* requests seen by this process, for sampling */
+static apr_uint32_t trace_counter = 0;
+
+static apr_status_t dbms_trace_flush(void *data)
+{
+    dbms_trace *trace = data;
+    dbms_trace_record *rec = (dbms_trace_record *)trace->records->elts;
+    apr_interval_time_t total = 0;
+    int i;
+
+    for (i = 0; i < trace->records->nelts; i++, rec++) {
+        total += rec->elapsed;
+        ap_log_error(APLOG_MARK, APLOG_NOTICE, 0, trace->server,
+                     "sql trace %s: #%d %s binds=%d rows=%d "
+                     "time=%" APR_TIME_T_FMT "us%s: %s", trace->id, i + 1,
+                     rec->caller, rec->nbinds, rec->nrows, rec->elapsed,
+                     rec->error ? " FAILED" : "", rec->template);
+    }
+
+    ap_log_error(APLOG_MARK, APLOG_NOTICE, 0, trace->server,
+                 "sql trace %s: %d statements, time=%" APR_TIME_T_FMT "us",
+                 trace->id, trace->records->nelts, total);
+    return APR_SUCCESS;
+}
+
+dbms_trace *dbms_trace_start(request_rec *r, const char *header, int sample)
+{
+    dbms_trace *trace;
+    const char *unique_id;
+
+    if (!(header && apr_table_get(r->headers_in, header))
+        && !(sample > 0 && apr_atomic_inc32(&trace_counter) % sample == 0))
+        return NULL;
+
+    trace = apr_pcalloc(r->pool, sizeof(*trace));
+    trace->pool = r->pool;
+    trace->server = r->server;
+    unique_id = apr_table_get(r->subprocess_env, "UNIQUE_ID");
+    trace->id = unique_id ? unique_id : r->the_request;
+    trace->records = apr_array_make(r->pool, 32, sizeof(dbms_trace_record));
+    apr_pool_cleanup_register(r->pool, trace, dbms_trace_flush,
+                              apr_pool_cleanup_null);
+    return trace;
+}
+
+dbms_trace_record *dbms_trace_add(dbms_trace *trace, const char *template,
+                                  const char *caller, int nbinds)
+{
+    dbms_trace_record *rec = apr_array_push(trace->records);
+
+    /* queries may be allocated from pools shorter-lived than the request */
+    rec->template = apr_pstrdup(trace->pool, template);
+    rec->caller = caller;
+    rec->nbinds = nbinds;
+    rec->nrows = 0;
+    rec->error = 0;
+    rec->elapsed = 0;
+    return rec;
+}
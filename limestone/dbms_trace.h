@@ -0,0 +1,69 @@
+/* ====================================================================
+ * Copyright 2007 Lime Spot LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * ====================================================================
+ */
+
+#ifndef __DBMS_TRACE_H__
+#define __DBMS_TRACE_H__
+
+#include <httpd.h>
+#include <apr_tables.h>
+#include <apr_time.h>
+
+/**
+ * Per-request SQL tracing. When a request is traced, every statement run
+ * through dbms_execute leaves one record behind; the records are written
+ * to the error log when the request pool is cleaned up. Requests that are
+ * not traced carry a NULL trace and pay for a single pointer test.
+ */
+
+typedef struct {
+    const char *template;       /* query string, with "?" placeholders */
+    const char *caller;         /* function that prepared the query */
+    int nbinds;                 /* number of placeholders */
+    int nrows;                  /* rows returned or affected */
+    int error;                  /* error code from the driver, 0 if none */
+    apr_interval_time_t elapsed;/* wall time spent in the database */
+} dbms_trace_record;
+
+typedef struct {
+    apr_pool_t *pool;           /* the request pool */
+    server_rec *server;
+    const char *id;             /* UNIQUE_ID or the request line */
+    apr_array_header_t *records;/* of dbms_trace_record */
+} dbms_trace;
+
+/**
+ * Decides whether a request is traced, and sets up its trace if it is
+ * @param r - the request
+ * @param header - trace requests carrying this header, NULL for none
+ * @param sample - also trace one in every sample requests, 0 for none
+ * @return the trace, NULL if the request is not traced
+ */
+dbms_trace *dbms_trace_start(request_rec *r, const char *header, int sample);
+
+/**
+ * Adds a record for a statement that is about to be executed
+ * @param trace - the request's trace
+ * @param template - the query string
+ * @param caller - the function that prepared the query
+ * @param nbinds - number of placeholders
+ * @return the record, to be completed once the statement has run
+ */
+dbms_trace_record *dbms_trace_add(dbms_trace *trace, const char *template,
+                                  const char *caller, int nbinds);
+
+#endif
@@ -3,6 +3,9 @@
 #include <apr_strings.h>
 #include "dav_repos.h"
 #include "dbms_dbd.h"
+#include "dbms_bind_cache.h"
+#include "dbms_acl_cache.h"
+#include "dbms_group_cache.h"
 
 int dbms_set_session_xaction_iso_level(apr_pool_t *pool,
                                        const dav_repos_db *d,
@@ -42,44 +45,93 @@ int dbms_set_session_xaction_iso_level(apr_pool_t *pool,
     return ret;
 }
 
-int dbms_transaction_start(apr_pool_t * pool, 
-                           const dav_repos_db *d,
-                           dav_repos_transaction **trans)
+static int dbms_transaction_begin(apr_pool_t * pool, 
+                                  const dav_repos_db *d,
+                                  const char *characteristics,
+                                  dav_repos_transaction **trans)
 {
     int ierrno;
     const dav_repos_dbms *db= d->db;
     apr_dbd_transaction_t *ap_trans = NULL;
     const apr_dbd_driver_t *driver = db->ap_dbd_dbms->driver;
     apr_dbd_t *handle = db->ap_dbd_dbms->handle;
-
-    TRACE();
+    int read_only = 0;
 
     ierrno = apr_dbd_transaction_start(driver, pool, handle, &ap_trans);
+    if (ierrno)
+        return ierrno;
 
-    if(!ierrno) {
-        /* Fill dav_repos_transaction */
-        *trans = apr_pcalloc(pool, sizeof(**trans));
-        (*trans)->pool = pool;
-        (*trans)->db = db;
-        (*trans)->ap_trans = ap_trans;
-    }
+    dbms_dbd_set_transaction(db, ap_trans);
 
+    /* both are sent along with the first query of the transaction */
+    if (characteristics && d->dbms == PGSQL)
+        read_only = !dbms_dbd_queue_statement
+          (db, apr_pstrcat(pool, "SET TRANSACTION ", characteristics, NULL));
 
-    if (d->dbms == PGSQL)
+    if (!read_only && d->dbms == PGSQL
+        && dbms_dbd_queue_statement(db, "SET CONSTRAINTS ALL DEFERRED"))
         dbms_defer_all_constraints(pool, d);
 
-    return ierrno;
+    /* Fill dav_repos_transaction */
+    *trans = apr_pcalloc(pool, sizeof(**trans));
+    (*trans)->pool = pool;
+    (*trans)->db = db;
+    (*trans)->ap_trans = ap_trans;
+    (*trans)->read_only = read_only;
+    (*trans)->bind_generation = dbms_bind_cache_generation();
+    (*trans)->acl_generation = dbms_acl_cache_generation();
+    (*trans)->group_generation = dbms_group_cache_generation();
+    dbms_dbd_set_read_only(db, read_only);
+
+    return 0;
+}
+
+int dbms_transaction_start(apr_pool_t * pool, 
+                           const dav_repos_db *d,
+                           dav_repos_transaction **trans)
+{
+    TRACE();
+
+    return dbms_transaction_begin(pool, d, NULL, trans);
+}
+
+int dbms_transaction_start_read_only(apr_pool_t * pool, 
+                                     const dav_repos_db *d,
+                                     dav_repos_transaction **trans)
+{
+    TRACE();
+
+    return dbms_transaction_begin(pool, d, d->read_only_xaction, trans);
 }
 
 int dbms_transaction_end(dav_repos_transaction *trans)
 {
     const dav_repos_dbms *db = trans->db;
     apr_pool_t *pool = trans->pool;
+    int ierrno;
 
     TRACE();
 
-    return apr_dbd_transaction_end(db->ap_dbd_dbms->driver, 
+    dbms_dbd_set_transaction(db, NULL);
+    ierrno = apr_dbd_transaction_end(db->ap_dbd_dbms->driver, 
                                      pool, trans->ap_trans);
+
+    /* serializable transactions may also fail when committing */
+    if (ierrno)
+        dbms_dbd_note_error(db, dbms_error(pool, db));
+
+    /* binds changed in the transaction were invalidated before they were
+     * committed; drop what other processes cached in between */
+    if (!trans->read_only
+        && trans->bind_generation != dbms_bind_cache_generation())
+        dbms_bind_cache_invalidate();
+    if (!trans->read_only
+        && trans->acl_generation != dbms_acl_cache_generation())
+        dbms_acl_cache_invalidate();
+    if (!trans->read_only
+        && trans->group_generation != dbms_group_cache_generation())
+        dbms_group_cache_invalidate();
+    return ierrno;
 }
 
 int dbms_transaction_mode_set(dav_repos_transaction *trans, int mode)
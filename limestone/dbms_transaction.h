@@ -28,6 +28,18 @@ struct dav_repos_transaction
 
     /* Transaction handle */
     apr_dbd_transaction_t *ap_trans;
+
+    /* started READ ONLY; writes will fail */
+    int read_only;
+
+    /* bind cache generation when the transaction started */
+    apr_uint32_t bind_generation;
+
+    /* ACL cache generation when the transaction started */
+    apr_uint32_t acl_generation;
+
+    /* group cache generation when the transaction started */
+    apr_uint32_t group_generation;
 };
 
 typedef struct dav_repos_transaction dav_repos_transaction;
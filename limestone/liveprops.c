@@ -21,6 +21,7 @@
 #include "bridge.h" /* for getetag_dbr */
 #include <apr_strings.h>
 #include <ctype.h>
+#include <string.h>
 
 #define DAV_DISPLAYNAME_LIMIT 256
 
@@ -158,7 +159,30 @@ static dav_prop_insert dav_repos_insert_prop(const dav_resource * resource,
     return what;
 }
 
+/* whether the DAV: property name is among names, always if names is NULL */
+static int dav_repos_lpr_wanted(const apr_array_header_t *names,
+                                const char *name)
+{
+    int i;
+
+    if (names == NULL)
+        return 1;
+
+    for (i = 0; i < names->nelts; i++) {
+        const dav_prop_name *pname = &APR_ARRAY_IDX(names, i, dav_prop_name);
+        if (!strcmp(pname->name, name) && !strcmp(pname->ns, "DAV:"))
+            return 1;
+    }
+    return 0;
+}
+
 void dav_repos_build_lpr_hash(dav_repos_resource * db_r)
+{
+    dav_repos_build_named_lpr_hash(db_r, NULL);
+}
+
+void dav_repos_build_named_lpr_hash(dav_repos_resource * db_r,
+                                    const apr_array_header_t *names)
 {
     const char *s;
     apr_pool_t *pool = db_r->p;
@@ -170,14 +194,16 @@ void dav_repos_build_lpr_hash(dav_repos_resource * db_r)
     db_r->lpr_hash = apr_hash_make(pool);
 
     /* set live properties */
-    char *creationdate = apr_pcalloc(pool, APR_RFC822_DATE_LEN * sizeof(char));
-    if (db_r->created_at != NULL) {
+    if (db_r->created_at != NULL
+        && dav_repos_lpr_wanted(names, "creationdate")) {
+        char *creationdate = apr_pcalloc(pool, APR_RFC822_DATE_LEN * sizeof(char));
 	dav_repos_format_strtime(DAV_STYLE_ISO8601, db_r->created_at, creationdate);
 	apr_hash_set(db_r->lpr_hash, "creationdate", APR_HASH_KEY_STRING, creationdate);
     }
 
-    char *getlastmodified = apr_pcalloc(pool, APR_RFC822_DATE_LEN * sizeof(char));
-    if (db_r->updated_at != NULL) {
+    if (db_r->updated_at != NULL
+        && dav_repos_lpr_wanted(names, "getlastmodified")) {
+        char getlastmodified[APR_RFC822_DATE_LEN] = "";
 	dav_repos_format_strtime(DAV_STYLE_RFC822, db_r->updated_at, getlastmodified);
 	apr_hash_set(db_r->lpr_hash, "getlastmodified", APR_HASH_KEY_STRING,
 		 apr_pstrdup(pool, getlastmodified));
@@ -192,14 +218,16 @@ void dav_repos_build_lpr_hash(dav_repos_resource * db_r)
         db_r->resourcetype == dav_repos_VERSIONED_COLLECTION)
         return;
 
-    if (db_r->getcontentlength != DAV_REPOS_NODATA) {
+    if (db_r->getcontentlength != DAV_REPOS_NODATA
+        && dav_repos_lpr_wanted(names, "getcontentlength")) {
 	s = apr_psprintf(pool, "%ld", db_r->getcontentlength);
 	apr_hash_set(db_r->lpr_hash, "getcontentlength",
 		     APR_HASH_KEY_STRING, s);
     }
 
-    apr_hash_set(db_r->lpr_hash, "getetag", APR_HASH_KEY_STRING,
-		 (char *)sabridge_getetag_dbr(db_r));
+    if (dav_repos_lpr_wanted(names, "getetag"))
+        apr_hash_set(db_r->lpr_hash, "getetag", APR_HASH_KEY_STRING,
+                     (char *)sabridge_getetag_dbr(db_r));
 
     if (db_r->getcontenttype) {
 	apr_hash_set(db_r->lpr_hash, "getcontenttype", APR_HASH_KEY_STRING,
@@ -43,6 +43,13 @@ const dav_liveprop_spec *get_livepropspec_from_id(const dav_liveprop_spec lps[],
  */
 void dav_repos_build_lpr_hash(dav_repos_resource * db_r);
 
+/* @brief Build the live properties among names only
+ * @param db_r contains the uuid, root_path and the pool 
+ * @param names The dav_prop_name asked for, NULL to build all of them
+ */
+void dav_repos_build_named_lpr_hash(dav_repos_resource * db_r,
+                                    const apr_array_header_t *names);
+
 /* @brief Return a string of all the liveprop names in the array
  * @param pool The pool to allocate the string from
  * @param lps The array of liveprop specifications
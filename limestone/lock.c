@@ -25,6 +25,7 @@
 #include "lock_bridge.h"
 #include "bridge.h"
 #include "dav_repos.h"  /* for dav_repos_get_db */
+#include "response_cache.h"    /* for dav_repos_response_cache_skip */
 /*
  ** This must be forward-declared so the open_lockdb function can use it.
  */
@@ -231,11 +232,18 @@ static dav_error *dav_repos_get_locks(dav_lockdb *lockdb,
                                       int calltype,
                                       dav_lock **locks)
 {
+    dav_error *err;
+
     TRACE();
 
     *locks = NULL;
-    return dbms_get_locks(lockdb, resource->info->db_r, 
-                          calltype==DAV_GETLOCKS_RESOLVED, locks);
+    err = dbms_get_locks(lockdb, resource->info->db_r, 
+                         calltype==DAV_GETLOCKS_RESOLVED, locks);
+
+    /* their timeouts count down without anything being written */
+    if (*locks)
+        dav_repos_response_cache_skip(lockdb->info->r);
+    return err;
 }
 
 static dav_error *dav_repos_find_lock(dav_lockdb *lockdb,
@@ -0,0 +1,205 @@
+/* ====================================================================
+ * Copyright 2007 Lime Spot LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * ====================================================================
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <apr_atomic.h>
+#include <apr_shm.h>
+#include <apr_strings.h>
+
+#include "lru_cache.h"
+
+#if APR_HAS_THREADS
+#define LRU_CACHE_LOCK(cache) apr_thread_mutex_lock((cache)->mutex)
+#define LRU_CACHE_UNLOCK(cache) apr_thread_mutex_unlock((cache)->mutex)
+#else
+#define LRU_CACHE_LOCK(cache)
+#define LRU_CACHE_UNLOCK(cache)
+#endif
+
+apr_status_t dav_repos_lru_cache_init(dav_repos_lru_cache *cache,
+                                      apr_pool_t *pproc)
+{
+    apr_shm_t *shm = NULL;
+    apr_status_t rv;
+
+    /* the segment outlives restarts, so that children still finishing
+     * requests after a graceful restart invalidate the new children's
+     * caches too */
+    apr_pool_userdata_get((void **)&shm, cache->shm_key, pproc);
+    if (!shm) {
+        rv = apr_shm_create(&shm, sizeof(apr_uint32_t), NULL, pproc);
+        if (rv != APR_SUCCESS) {
+            cache->generation = &cache->private_generation;
+            return rv;
+        }
+        apr_atomic_set32(apr_shm_baseaddr_get(shm), 0);
+        apr_pool_userdata_setn(shm, cache->shm_key, NULL, pproc);
+    }
+
+    cache->generation = apr_shm_baseaddr_get(shm);
+    return APR_SUCCESS;
+}
+
+static void lru_cache_unlink(dav_repos_lru_node *node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+}
+
+static void lru_cache_link_first(dav_repos_lru_cache *cache,
+                                 dav_repos_lru_node *node)
+{
+    node->next = cache->lru.next;
+    node->prev = &cache->lru;
+    cache->lru.next->prev = node;
+    cache->lru.next = node;
+}
+
+static void lru_cache_remove(dav_repos_lru_cache *cache,
+                             dav_repos_lru_node *node)
+{
+    lru_cache_unlink(node);
+    apr_hash_set(cache->table, node->key, node->klen, NULL);
+    cache->used -= node->cost;
+    free(node);
+}
+
+/* drop everything once the generation has moved on, called locked */
+static void lru_cache_sync(dav_repos_lru_cache *cache)
+{
+    apr_uint32_t generation = apr_atomic_read32(cache->generation);
+
+    if (generation == cache->table_generation)
+        return;
+
+    while (cache->lru.next != &cache->lru)
+        lru_cache_remove(cache, cache->lru.next);
+    cache->table_generation = generation;
+}
+
+static apr_status_t lru_cache_cleanup(void *data)
+{
+    dav_repos_lru_cache *cache = data;
+
+    while (cache->lru.next != &cache->lru)
+        lru_cache_remove(cache, cache->lru.next);
+    cache->table = NULL;
+    return APR_SUCCESS;
+}
+
+void dav_repos_lru_cache_child_init(dav_repos_lru_cache *cache,
+                                    apr_pool_t *pchild, apr_size_t size,
+                                    apr_interval_time_t ttl)
+{
+    if (size == 0)
+        return;
+
+#if APR_HAS_THREADS
+    if (apr_thread_mutex_create(&cache->mutex, APR_THREAD_MUTEX_DEFAULT,
+                                pchild) != APR_SUCCESS)
+        return;
+#endif
+
+    cache->lru.next = cache->lru.prev = &cache->lru;
+    cache->size = size;
+    cache->ttl = ttl;
+    cache->table_generation = apr_atomic_read32(cache->generation);
+    cache->table = apr_hash_make(pchild);
+    apr_pool_cleanup_register(pchild, cache, lru_cache_cleanup,
+                              apr_pool_cleanup_null);
+}
+
+int dav_repos_lru_cache_enabled(const dav_repos_lru_cache *cache)
+{
+    return cache->table != NULL;
+}
+
+apr_uint32_t dav_repos_lru_cache_generation(const dav_repos_lru_cache *cache)
+{
+    return apr_atomic_read32(cache->generation);
+}
+
+void dav_repos_lru_cache_invalidate(dav_repos_lru_cache *cache)
+{
+    apr_atomic_inc32(cache->generation);
+}
+
+int dav_repos_lru_cache_current(const dav_repos_lru_cache *cache,
+                                apr_uint32_t generation)
+{
+    return cache->table
+      && generation == apr_atomic_read32(cache->generation);
+}
+
+void *dav_repos_lru_cache_get(dav_repos_lru_cache *cache, apr_pool_t *pool,
+                              apr_uint32_t generation,
+                              const void *key, apr_ssize_t klen)
+{
+    dav_repos_lru_node *node;
+    void *copy = NULL;
+
+    if (!cache->table)
+        return NULL;
+
+    LRU_CACHE_LOCK(cache);
+    lru_cache_sync(cache);
+    node = generation == cache->table_generation
+      ? apr_hash_get(cache->table, key, klen) : NULL;
+    if (node && node->expires && node->expires <= apr_time_now()) {
+        lru_cache_remove(cache, node);
+        node = NULL;
+    }
+    if (node) {
+        lru_cache_unlink(node);
+        lru_cache_link_first(cache, node);
+        copy = apr_pmemdup(pool, node, node->alloc);
+    }
+    LRU_CACHE_UNLOCK(cache);
+
+    return copy;
+}
+
+void dav_repos_lru_cache_put(dav_repos_lru_cache *cache,
+                             apr_uint32_t generation,
+                             dav_repos_lru_node *node)
+{
+    if (!dav_repos_lru_cache_current(cache, generation)
+        || node->cost > cache->size) {
+        free(node);
+        return;
+    }
+
+    node->expires = cache->ttl ? apr_time_now() + cache->ttl : 0;
+
+    LRU_CACHE_LOCK(cache);
+    lru_cache_sync(cache);
+    if (generation != cache->table_generation
+        || apr_hash_get(cache->table, node->key, node->klen)) {
+        LRU_CACHE_UNLOCK(cache);
+        free(node);
+        return;
+    }
+
+    while (cache->used + node->cost > cache->size)
+        lru_cache_remove(cache, cache->lru.prev);
+    lru_cache_link_first(cache, node);
+    apr_hash_set(cache->table, node->key, node->klen, node);
+    cache->used += node->cost;
+    LRU_CACHE_UNLOCK(cache);
+}
@@ -0,0 +1,148 @@
+/* ====================================================================
+ * Copyright 2007 Lime Spot LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * ====================================================================
+ */
+
+#ifndef __LRU_CACHE_H__
+#define __LRU_CACHE_H__
+
+#include <apr_pools.h>
+#include <apr_hash.h>
+#include <apr_time.h>
+#if APR_HAS_THREADS
+#include <apr_thread_mutex.h>
+#endif
+
+/**
+ * Per-process LRU cache the bind, response, ACL and group caches are
+ * built on. Each process holds its own entries, while a generation
+ * counter bumped on every change to what they were read from is shared
+ * by all processes of the server; entries filled under an older
+ * generation are never served, and neither are entries older than the
+ * time to live, when there is one. The caches built on it only lay out
+ * their entries and keys.
+ */
+
+/**
+ * Header of an entry. An entry is malloc'ed as one block starting with
+ * this header, holding its key and values without pointing outside of
+ * the block, so that it can be copied out whole
+ */
+typedef struct dav_repos_lru_node {
+    struct dav_repos_lru_node *prev, *next; /* most recently used first */
+    apr_time_t expires;         /* 0 for never */
+    apr_size_t alloc;           /* bytes in the block */
+    apr_size_t cost;            /* counted against the size of the cache */
+    const void *key;            /* in the block */
+    apr_ssize_t klen;
+} dav_repos_lru_node;
+
+typedef struct {
+    const char *shm_key;        /* names the counter across restarts */
+
+    /* shared between processes when the shared memory could be had */
+    volatile apr_uint32_t *generation;
+    apr_uint32_t private_generation;
+
+    apr_uint32_t table_generation;  /* generation of what is in the table */
+    apr_hash_t *table;              /* key -> node, NULL if disabled */
+    dav_repos_lru_node lru;         /* list head */
+    apr_size_t used;                /* sum of the costs of the entries */
+    apr_size_t size;
+    apr_interval_time_t ttl;        /* 0 for none */
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;
+#endif
+} dav_repos_lru_cache;
+
+/* initializer of a static dav_repos_lru_cache named cache */
+#define DAV_REPOS_LRU_CACHE_INIT(cache, shm_key) \
+    { shm_key, &(cache).private_generation }
+
+/**
+ * Sets up the shared generation counter, before the children are forked
+ * @param cache - The cache
+ * @param pproc - The process pool
+ * @return APR_SUCCESS, or why the counter is private to each process
+ */
+apr_status_t dav_repos_lru_cache_init(dav_repos_lru_cache *cache,
+                                      apr_pool_t *pproc);
+
+/**
+ * Sets up this process' cache
+ * @param cache - The cache
+ * @param pchild - The child's pool
+ * @param size - The most the costs of the entries may add up to
+ * @param ttl - How long an entry is served for, 0 for as long as the
+ * generation lasts
+ */
+void dav_repos_lru_cache_child_init(dav_repos_lru_cache *cache,
+                                    apr_pool_t *pchild, apr_size_t size,
+                                    apr_interval_time_t ttl);
+
+/**
+ * @param cache - The cache
+ * @return 1 if this process has the cache, 0 otherwise
+ */
+int dav_repos_lru_cache_enabled(const dav_repos_lru_cache *cache);
+
+/**
+ * @param cache - The cache
+ * @return The current generation
+ */
+apr_uint32_t dav_repos_lru_cache_generation(const dav_repos_lru_cache *cache);
+
+/**
+ * Drops every entry, in this process and all others
+ * @param cache - The cache
+ */
+void dav_repos_lru_cache_invalidate(dav_repos_lru_cache *cache);
+
+/**
+ * @param cache - The cache
+ * @param generation - The generation read before the values were queried
+ * @return 1 if an entry filled under the generation would be kept, 0
+ * otherwise, to skip building it
+ */
+int dav_repos_lru_cache_current(const dav_repos_lru_cache *cache,
+                                apr_uint32_t generation);
+
+/**
+ * Looks up an entry
+ * @param cache - The cache
+ * @param pool - The pool to copy the entry into
+ * @param generation - The generation the caller read its data under
+ * @param key - The key
+ * @param klen - The length of the key
+ * @return A copy of the whole entry, whose header is not to be used,
+ * NULL if not found
+ */
+void *dav_repos_lru_cache_get(dav_repos_lru_cache *cache, apr_pool_t *pool,
+                              apr_uint32_t generation,
+                              const void *key, apr_ssize_t klen);
+
+/**
+ * Remembers an entry, evicting the least recently used ones to make room
+ * @param cache - The cache
+ * @param generation - The generation read before the values were queried
+ * @param node - The entry, malloc'ed, with alloc, cost, key and klen set.
+ * The cache takes it over, freeing it if it is not kept
+ */
+void dav_repos_lru_cache_put(dav_repos_lru_cache *cache,
+                             apr_uint32_t generation,
+                             dav_repos_lru_node *node);
+
+#endif /* __LRU_CACHE_H__ */
@@ -45,11 +45,18 @@
 #include "scoreboard.h"      /* for pre_mpm hook */
 #include "dav_repos.h"
 #include "dbms.h"
+#include "dbms_api.h"           /* for dbms_api_replica_create */
 #include "dbms_principal.h"     /* for get_canonical_username */
 #include "liveprops.h"
 #include "gc.h"
+#include "transaction.h"    /* for the retry handler */
+#include "dbms_bind_cache.h"
+#include "response_cache.h"
+#include "dbms_acl_cache.h"
+#include "dbms_group_cache.h"
 
 #include "ap_provider.h"        /* for ap_lookup_provider */
+#include "ap_mpm.h"             /* for ap_mpm_query */
 
 #define INHERIT_VALUE(parent, child, field) \
   ((child)->field ? (child)->field : (parent)->field)
@@ -66,6 +73,19 @@ static void *dav_repos_create_server_config(apr_pool_t * p, server_rec *s)
     /* defaults */
     conf->quota = 10*1024*1024; /* 10 MB */
     conf->keep_files = 1;
+    conf->fetch_size = 1000;
+    conf->xaction_retries = 3;
+    conf->retry_body_limit = 1024*1024; /* 1 MB */
+    conf->read_only_xaction = "ISOLATION LEVEL SERIALIZABLE READ ONLY";
+    conf->replica_sticky = 30;
+    conf->bind_cache_size = 4096;
+    conf->bind_cache_ttl = 60;
+    conf->response_cache_size = 4*1024*1024; /* 4 MB */
+    conf->response_cache_ttl = 10;
+    conf->acl_cache_size = 16384;
+    conf->acl_cache_ttl = 60;
+    conf->group_cache_size = 1024;
+    conf->group_cache_ttl = 300;
     return conf;
 }
 
@@ -84,6 +104,30 @@ static void *dav_repos_merge_server_config(apr_pool_t * p, void *base,
     newconf->db_driver = INHERIT_VALUE(parent, child, db_driver);
     newconf->dbms = INHERIT_VALUE(parent, child, dbms);
     newconf->db_params = INHERIT_VALUE(parent, child, db_params);
+    newconf->fetch_size = INHERIT_VALUE(parent, child, fetch_size);
+    newconf->trace_header = INHERIT_VALUE(parent, child, trace_header);
+    newconf->trace_sample = INHERIT_VALUE(parent, child, trace_sample);
+    newconf->repeat_warn = INHERIT_VALUE(parent, child, repeat_warn);
+    newconf->repeat_budget = INHERIT_VALUE(parent, child, repeat_budget);
+    newconf->xaction_retries = INHERIT_VALUE(parent, child, xaction_retries);
+    newconf->retry_body_limit = INHERIT_VALUE(parent, child, retry_body_limit);
+    newconf->read_only_xaction = child->read_only_xaction_set ?
+      child->read_only_xaction : parent->read_only_xaction;
+    newconf->read_only_xaction_set = child->read_only_xaction_set
+      || parent->read_only_xaction_set;
+    newconf->replica_driver = INHERIT_VALUE(parent, child, replica_driver);
+    newconf->replica_params = INHERIT_VALUE(parent, child, replica_params);
+    newconf->replica_sticky = INHERIT_VALUE(parent, child, replica_sticky);
+    newconf->bind_cache_size = INHERIT_VALUE(parent, child, bind_cache_size);
+    newconf->bind_cache_ttl = INHERIT_VALUE(parent, child, bind_cache_ttl);
+    newconf->response_cache_size =
+      INHERIT_VALUE(parent, child, response_cache_size);
+    newconf->response_cache_ttl =
+      INHERIT_VALUE(parent, child, response_cache_ttl);
+    newconf->acl_cache_size = INHERIT_VALUE(parent, child, acl_cache_size);
+    newconf->acl_cache_ttl = INHERIT_VALUE(parent, child, acl_cache_ttl);
+    newconf->group_cache_size = INHERIT_VALUE(parent, child, group_cache_size);
+    newconf->group_cache_ttl = INHERIT_VALUE(parent, child, group_cache_ttl);
 
     newconf->use_gc = INHERIT_VALUE(parent, child, use_gc);
     newconf->keep_files = INHERIT_VALUE(parent, child, keep_files);
@@ -99,7 +143,7 @@ static void *dav_repos_merge_server_config(apr_pool_t * p, void *base,
  */
 dav_repos_db *dav_repos_get_db(request_rec * r)
 {
-    dav_repos_db *db;
+    dav_repos_db *db, *conf;
 
     if (r == NULL)
 	return NULL;
@@ -107,8 +151,30 @@ dav_repos_db *dav_repos_get_db(request_rec * r)
     db = ap_get_module_config(r->request_config, &dav_repos_module);
     if (db) return db;
 
-    db = ap_get_module_config(r->server->module_config, &dav_repos_module);
-    db = memcpy(apr_palloc(r->pool, sizeof(*db)), db, sizeof(*db));
+    conf = ap_get_module_config(r->server->module_config, &dav_repos_module);
+    db = memcpy(apr_palloc(r->pool, sizeof(*db)), conf, sizeof(*db));
+    db->response_generation = dav_repos_response_cache_generation();
+    db->acl_generation = dbms_acl_cache_generation();
+    db->group_generation = dbms_group_cache_generation();
+
+    /* reads go to the replica unless the client has written something
+     * the replica has not caught up with yet */
+    if (db->replica && dav_repos_is_read_only_request(r)) {
+        long txid = dav_repos_get_written_txid(r);
+
+        if (dbms_opendb_replica(db, r->pool, r) == 0
+            && (!txid || dbms_txid_visible(r->pool, db, txid))) {
+            ap_set_module_config(r->request_config, &dav_repos_module, db);
+            return db;
+        }
+
+        if (db->db)
+            dbms_closedb(db);
+        db = memcpy(db, conf, sizeof(*db));
+        db->response_generation = dav_repos_response_cache_generation();
+        db->acl_generation = dbms_acl_cache_generation();
+        db->group_generation = dbms_group_cache_generation();
+    }
 
     if (dbms_opendb(db, r->pool, r, NULL, NULL))
         db = NULL;
@@ -161,6 +227,290 @@ static const char *dav_repos_dbd_params_cmd(cmd_parms * cmd,
     return NULL;
 }
 
+static const char *dav_repos_fetch_size_cmd(cmd_parms * cmd,
+                                            void *config, const char *arg1)
+{
+    dav_repos_server_conf *conf = 
+      ap_get_module_config(cmd->server->module_config, &dav_repos_module);
+    int fetch_size = atoi(arg1);
+
+    if (fetch_size < 0)
+        return "DAVLimestoneFetchSize must not be negative";
+
+    /* zero would be taken as unset when merging, so use -1 to turn
+     * streaming off */
+    conf->fetch_size = fetch_size ? fetch_size : -1;
+    return NULL;
+}
+
+static const char *dav_repos_trace_header_cmd(cmd_parms *cmd, void *config,
+                                              const char *arg1)
+{
+    dav_repos_server_conf *conf = 
+      ap_get_module_config(cmd->server->module_config, &dav_repos_module);
+    conf->trace_header = apr_pstrdup(cmd->pool, arg1);
+    return NULL;
+}
+
+static const char *dav_repos_trace_sample_cmd(cmd_parms *cmd, void *config,
+                                              const char *arg1)
+{
+    dav_repos_server_conf *conf = 
+      ap_get_module_config(cmd->server->module_config, &dav_repos_module);
+    conf->trace_sample = atoi(arg1);
+    if (conf->trace_sample < 0)
+        return "DAVLimestoneTraceSample must not be negative";
+    return NULL;
+}
+
+static const char *dav_repos_repeat_warn_cmd(cmd_parms *cmd, void *config,
+                                             const char *arg1)
+{
+    dav_repos_server_conf *conf = 
+      ap_get_module_config(cmd->server->module_config, &dav_repos_module);
+    conf->repeat_warn = atoi(arg1);
+    if (conf->repeat_warn < 0)
+        return "DAVLimestoneQueryRepeatWarn must not be negative";
+    return NULL;
+}
+
+static const char *dav_repos_repeat_budget_cmd(cmd_parms *cmd, void *config,
+                                               const char *arg1)
+{
+#ifdef DEBUG
+    dav_repos_server_conf *conf = 
+      ap_get_module_config(cmd->server->module_config, &dav_repos_module);
+    conf->repeat_budget = atoi(arg1);
+    if (conf->repeat_budget < 0)
+        return "DAVLimestoneQueryRepeatBudget must not be negative";
+    return NULL;
+#else
+    return "DAVLimestoneQueryRepeatBudget is only available in builds "
+      "configured --with-debug";
+#endif
+}
+
+static const char *dav_repos_xaction_retries_cmd(cmd_parms *cmd,
+                                                 void *config,
+                                                 const char *arg1)
+{
+    dav_repos_server_conf *conf = 
+      ap_get_module_config(cmd->server->module_config, &dav_repos_module);
+    int retries = atoi(arg1);
+
+    if (retries < 0)
+        return "DAVLimestoneTransactionRetries must not be negative";
+
+    /* zero would be taken as unset when merging */
+    conf->xaction_retries = retries ? retries : -1;
+    return NULL;
+}
+
+static const char *dav_repos_retry_body_limit_cmd(cmd_parms *cmd,
+                                                  void *config,
+                                                  const char *arg1)
+{
+    dav_repos_server_conf *conf = 
+      ap_get_module_config(cmd->server->module_config, &dav_repos_module);
+
+    conf->retry_body_limit = apr_atoi64(arg1);
+    if (conf->retry_body_limit <= 0)
+        return "DAVLimestoneRetryBodyLimit must be positive";
+    return NULL;
+}
+
+static const char *dav_repos_read_only_xaction_cmd(cmd_parms *cmd,
+                                                   void *config,
+                                                   const char *arg1)
+{
+    dav_repos_server_conf *conf = 
+      ap_get_module_config(cmd->server->module_config, &dav_repos_module);
+
+    if (!strcasecmp(arg1, "off"))
+        conf->read_only_xaction = NULL;
+    else if (!strcasecmp(arg1, "serializable"))
+        conf->read_only_xaction = "ISOLATION LEVEL SERIALIZABLE READ ONLY";
+    else if (!strcasecmp(arg1, "deferrable"))
+        conf->read_only_xaction =
+          "ISOLATION LEVEL SERIALIZABLE READ ONLY DEFERRABLE";
+    else if (!strcasecmp(arg1, "repeatable-read"))
+        conf->read_only_xaction = "ISOLATION LEVEL REPEATABLE READ READ ONLY";
+    else if (!strcasecmp(arg1, "read-committed"))
+        conf->read_only_xaction = "ISOLATION LEVEL READ COMMITTED READ ONLY";
+    else
+        return "DAVLimestoneReadOnlyTransactions must be one of Off, "
+          "Serializable, Deferrable, Repeatable-Read or Read-Committed";
+
+    conf->read_only_xaction_set = 1;
+    return NULL;
+}
+
+static const char *dav_repos_replica_driver_cmd(cmd_parms *cmd,
+                                                void *config, const char *arg1)
+{
+    dav_repos_server_conf *conf = 
+      ap_get_module_config(cmd->server->module_config, &dav_repos_module);
+
+    if (strcasecmp(arg1, "pgsql"))
+        return "DBReplicaDriver must be pgsql";
+    conf->replica_driver = arg1;
+    return NULL;
+}
+
+static const char *dav_repos_replica_params_cmd(cmd_parms *cmd,
+                                                void *config, const char *arg1)
+{
+    dav_repos_server_conf *conf = 
+      ap_get_module_config(cmd->server->module_config, &dav_repos_module);
+    conf->replica_params = arg1;
+    return NULL;
+}
+
+static const char *dav_repos_replica_sticky_cmd(cmd_parms *cmd,
+                                                void *config, const char *arg1)
+{
+    dav_repos_server_conf *conf = 
+      ap_get_module_config(cmd->server->module_config, &dav_repos_module);
+
+    conf->replica_sticky = atoi(arg1);
+    if (conf->replica_sticky <= 0)
+        return "DBReplicaSticky must be positive";
+    return NULL;
+}
+
+static const char *dav_repos_bind_cache_size_cmd(cmd_parms *cmd,
+                                                 void *config, const char *arg1)
+{
+    dav_repos_server_conf *conf = 
+      ap_get_module_config(cmd->server->module_config, &dav_repos_module);
+    int size = atoi(arg1);
+
+    if (cmd->server->is_virtual)
+        return "DAVLimestoneBindCacheSize is only allowed in the main server";
+    if (size < 0)
+        return "DAVLimestoneBindCacheSize must not be negative";
+
+    /* -1 rather than 0, which would be taken as unset */
+    conf->bind_cache_size = size ? size : -1;
+    return NULL;
+}
+
+static const char *dav_repos_bind_cache_ttl_cmd(cmd_parms *cmd,
+                                                void *config, const char *arg1)
+{
+    dav_repos_server_conf *conf = 
+      ap_get_module_config(cmd->server->module_config, &dav_repos_module);
+
+    if (cmd->server->is_virtual)
+        return "DAVLimestoneBindCacheTTL is only allowed in the main server";
+
+    conf->bind_cache_ttl = atoi(arg1);
+    if (conf->bind_cache_ttl <= 0)
+        return "DAVLimestoneBindCacheTTL must be positive";
+    return NULL;
+}
+
+static const char *dav_repos_response_cache_size_cmd(cmd_parms *cmd,
+                                                     void *config,
+                                                     const char *arg1)
+{
+    dav_repos_server_conf *conf = 
+      ap_get_module_config(cmd->server->module_config, &dav_repos_module);
+    int size = atoi(arg1);
+
+    if (cmd->server->is_virtual)
+        return "DAVLimestoneResponseCacheSize is only allowed in the main "
+          "server";
+    if (size < 0)
+        return "DAVLimestoneResponseCacheSize must not be negative";
+
+    /* -1 rather than 0, which would be taken as unset */
+    conf->response_cache_size = size ? size : -1;
+    return NULL;
+}
+
+static const char *dav_repos_response_cache_ttl_cmd(cmd_parms *cmd,
+                                                    void *config,
+                                                    const char *arg1)
+{
+    dav_repos_server_conf *conf = 
+      ap_get_module_config(cmd->server->module_config, &dav_repos_module);
+
+    if (cmd->server->is_virtual)
+        return "DAVLimestoneResponseCacheTTL is only allowed in the main "
+          "server";
+
+    conf->response_cache_ttl = atoi(arg1);
+    if (conf->response_cache_ttl <= 0)
+        return "DAVLimestoneResponseCacheTTL must be positive";
+    return NULL;
+}
+
+static const char *dav_repos_acl_cache_size_cmd(cmd_parms *cmd,
+                                                void *config, const char *arg1)
+{
+    dav_repos_server_conf *conf = 
+      ap_get_module_config(cmd->server->module_config, &dav_repos_module);
+    int size = atoi(arg1);
+
+    if (cmd->server->is_virtual)
+        return "DAVLimestoneAclCacheSize is only allowed in the main server";
+    if (size < 0)
+        return "DAVLimestoneAclCacheSize must not be negative";
+
+    /* -1 rather than 0, which would be taken as unset */
+    conf->acl_cache_size = size ? size : -1;
+    return NULL;
+}
+
+static const char *dav_repos_acl_cache_ttl_cmd(cmd_parms *cmd,
+                                               void *config, const char *arg1)
+{
+    dav_repos_server_conf *conf = 
+      ap_get_module_config(cmd->server->module_config, &dav_repos_module);
+
+    if (cmd->server->is_virtual)
+        return "DAVLimestoneAclCacheTTL is only allowed in the main server";
+
+    conf->acl_cache_ttl = atoi(arg1);
+    if (conf->acl_cache_ttl <= 0)
+        return "DAVLimestoneAclCacheTTL must be positive";
+    return NULL;
+}
+
+static const char *dav_repos_group_cache_size_cmd(cmd_parms *cmd,
+                                                  void *config,
+                                                  const char *arg1)
+{
+    dav_repos_server_conf *conf = 
+      ap_get_module_config(cmd->server->module_config, &dav_repos_module);
+    int size = atoi(arg1);
+
+    if (cmd->server->is_virtual)
+        return "DAVLimestoneGroupCacheSize is only allowed in the main server";
+    if (size < 0)
+        return "DAVLimestoneGroupCacheSize must not be negative";
+
+    /* -1 rather than 0, which would be taken as unset */
+    conf->group_cache_size = size ? size : -1;
+    return NULL;
+}
+
+static const char *dav_repos_group_cache_ttl_cmd(cmd_parms *cmd,
+                                                 void *config, const char *arg1)
+{
+    dav_repos_server_conf *conf = 
+      ap_get_module_config(cmd->server->module_config, &dav_repos_module);
+
+    if (cmd->server->is_virtual)
+        return "DAVLimestoneGroupCacheTTL is only allowed in the main server";
+
+    conf->group_cache_ttl = atoi(arg1);
+    if (conf->group_cache_ttl <= 0)
+        return "DAVLimestoneGroupCacheTTL must be positive";
+    return NULL;
+}
+
 static const char *dav_repos_gc_cmd(cmd_parms *cmd, void *config)
 {
     dav_repos_server_conf *conf = 
@@ -244,6 +594,96 @@ static const command_rec dav_repos_cmds[] = {
     AP_INIT_TAKE1("DBDParams", dav_repos_dbd_params_cmd, NULL, RSRC_CONF,
                   "SQL Driver Params"),
 
+    AP_INIT_TAKE1("DBReplicaDriver", dav_repos_replica_driver_cmd, NULL,
+                  RSRC_CONF, "SQL Driver of a read replica serving GET, "
+                  "PROPFIND, REPORT and SEARCH"),
+
+    AP_INIT_TAKE1("DBReplicaParams", dav_repos_replica_params_cmd, NULL,
+                  RSRC_CONF, "SQL Driver Params of the read replica"),
+
+    AP_INIT_TAKE1("DBReplicaSticky", dav_repos_replica_sticky_cmd, NULL,
+                  RSRC_CONF, "seconds a client's reads may wait on the "
+                  "replica replaying its last write (default 30)"),
+
+    AP_INIT_TAKE1("DAVLimestoneBindCacheSize", dav_repos_bind_cache_size_cmd,
+                  NULL, RSRC_CONF, "number of binds each process caches to "
+                  "resolve URIs (default 4096, 0 to disable)"),
+
+    AP_INIT_TAKE1("DAVLimestoneBindCacheTTL", dav_repos_bind_cache_ttl_cmd,
+                  NULL, RSRC_CONF, "seconds binds are cached for; bounds how "
+                  "long bind changes made by other servers or in SQL go "
+                  "unseen (default 60)"),
+
+    AP_INIT_TAKE1("DAVLimestoneResponseCacheSize",
+                  dav_repos_response_cache_size_cmd, NULL, RSRC_CONF,
+                  "bytes of depth 0 and 1 PROPFIND responses and collection "
+                  "indexes each process caches (default 4 MB, 0 to disable)"),
+
+    AP_INIT_TAKE1("DAVLimestoneResponseCacheTTL",
+                  dav_repos_response_cache_ttl_cmd, NULL, RSRC_CONF,
+                  "seconds PROPFIND responses and collection indexes are "
+                  "cached for; bounds how long writes made by other servers "
+                  "go unseen (default 10)"),
+
+    AP_INIT_TAKE1("DAVLimestoneAclCacheSize", dav_repos_acl_cache_size_cmd,
+                  NULL, RSRC_CONF, "number of privileges, group closures and "
+                  "resource ACLs each process caches to decide ACL checks "
+                  "(default 16384, 0 to disable)"),
+
+    AP_INIT_TAKE1("DAVLimestoneAclCacheTTL", dav_repos_acl_cache_ttl_cmd,
+                  NULL, RSRC_CONF, "seconds ACL entries are cached for; "
+                  "bounds how long ACL changes made by other servers go "
+                  "unseen (default 60)"),
+
+    AP_INIT_TAKE1("DAVLimestoneGroupCacheSize",
+                  dav_repos_group_cache_size_cmd, NULL, RSRC_CONF,
+                  "number of principals whose groups each process caches "
+                  "(default 1024, 0 to disable)"),
+
+    AP_INIT_TAKE1("DAVLimestoneGroupCacheTTL", dav_repos_group_cache_ttl_cmd,
+                  NULL, RSRC_CONF, "seconds the groups of a principal are "
+                  "cached for; bounds how long changes made by other servers "
+                  "go unseen (default 300)"),
+
+    AP_INIT_TAKE1("DAVLimestoneFetchSize", dav_repos_fetch_size_cmd, NULL,
+                  RSRC_CONF, "number of rows fetched at a time when streaming "
+                  "large result sets (0 buffers them whole)"),
+
+    AP_INIT_TAKE1("DAVLimestoneTraceHeader", dav_repos_trace_header_cmd, NULL,
+                  RSRC_CONF, "log the SQL statements of requests carrying "
+                  "this header"),
+
+    AP_INIT_TAKE1("DAVLimestoneTraceSample", dav_repos_trace_sample_cmd, NULL,
+                  RSRC_CONF, "log the SQL statements of one in every N "
+                  "requests"),
+
+    AP_INIT_TAKE1("DAVLimestoneQueryRepeatWarn", dav_repos_repeat_warn_cmd,
+                  NULL, RSRC_CONF, "warn when the same query runs more than "
+                  "N times in one request"),
+
+    AP_INIT_TAKE1("DAVLimestoneQueryRepeatBudget",
+                  dav_repos_repeat_budget_cmd, NULL, RSRC_CONF,
+                  "fail requests that run the same query more than N times "
+                  "(debug builds only)"),
+
+    AP_INIT_TAKE1("DAVLimestoneTransactionRetries",
+                  dav_repos_xaction_retries_cmd, NULL, RSRC_CONF,
+                  "how often to rerun a request whose transaction failed to "
+                  "serialize; PUT, DELETE, COPY, MOVE, BIND and the DeltaV "
+                  "methods, which change the content store, are never rerun "
+                  "(default 3, 0 to disable)"),
+
+    AP_INIT_TAKE1("DAVLimestoneRetryBodyLimit",
+                  dav_repos_retry_body_limit_cmd, NULL, RSRC_CONF,
+                  "largest request body, in bytes, kept in memory so that "
+                  "the request can be rerun (default 1 MB)"),
+
+    AP_INIT_TAKE1("DAVLimestoneReadOnlyTransactions",
+                  dav_repos_read_only_xaction_cmd, NULL, RSRC_CONF,
+                  "isolation of the READ ONLY transactions used by GET, "
+                  "PROPFIND, REPORT and SEARCH: Serializable (default), "
+                  "Deferrable, Repeatable-Read, Read-Committed or Off"),
+
     AP_INIT_NO_ARGS("DAVLimestoneUseGC", dav_repos_gc_cmd, NULL, RSRC_CONF,
                     "Enable the Garbage Collection in a separate thread"),
 
@@ -282,6 +722,10 @@ static const dav_provider dav_repos_provider = {
 };
 
 static server_rec *server_main = NULL;
+static int bind_cache_shared = 0;
+static int response_cache_shared = 0;
+static int acl_cache_shared = 0;
+static int group_cache_shared = 0;
 
 static int dav_repos_post_config(apr_pool_t * pconf, apr_pool_t * plog,
                                  apr_pool_t * ptemp, server_rec * s)
@@ -323,6 +767,36 @@ static int dav_repos_post_config(apr_pool_t * pconf, apr_pool_t * plog,
     }
     ap_cfg_closefile(f);
 
+    /* the bind cache is only safe when every process sees the others'
+     * invalidations */
+    status = dbms_bind_cache_init(s->process->pool);
+    bind_cache_shared = (status == APR_SUCCESS);
+    if (!bind_cache_shared)
+        ap_log_error(APLOG_MARK, APLOG_WARNING, status, s,
+                     "could not share the bind cache generation between "
+                     "processes, disabling the bind cache");
+
+    status = dav_repos_response_cache_init(s->process->pool);
+    response_cache_shared = (status == APR_SUCCESS);
+    if (!response_cache_shared)
+        ap_log_error(APLOG_MARK, APLOG_WARNING, status, s,
+                     "could not share the response cache generation between "
+                     "processes, disabling the response cache");
+
+    status = dbms_acl_cache_init(s->process->pool);
+    acl_cache_shared = (status == APR_SUCCESS);
+    if (!acl_cache_shared)
+        ap_log_error(APLOG_MARK, APLOG_WARNING, status, s,
+                     "could not share the ACL cache generation between "
+                     "processes, disabling the ACL cache");
+
+    status = dbms_group_cache_init(s->process->pool);
+    group_cache_shared = (status == APR_SUCCESS);
+    if (!group_cache_shared)
+        ap_log_error(APLOG_MARK, APLOG_WARNING, status, s,
+                     "could not share the group cache generation between "
+                     "processes, disabling the group cache");
+
     /* populate the resource_types array */
     dav_repos_resource_types[dav_repos_RESOURCE] = "Resource";
     dav_repos_resource_types[dav_repos_COLLECTION] = "Collection";
@@ -363,6 +837,51 @@ static int dav_repos_pre_mpm(apr_pool_t *pool, ap_scoreboard_e sb_type)
     return OK;
 }
 
+static void dav_repos_child_init(apr_pool_t *pool, server_rec *s)
+{
+    server_rec *sp;
+    dav_repos_db *main_conf =
+      ap_get_module_config(s->module_config, &dav_repos_module);
+    int threads = 1;
+
+#if APR_HAS_THREADS
+    ap_mpm_query(AP_MPMQ_MAX_THREADS, &threads);
+    if (threads < 1)
+        threads = 1;
+#endif
+
+    if (bind_cache_shared)
+        dbms_bind_cache_child_init(pool, main_conf->bind_cache_size,
+                                   apr_time_from_sec
+                                   (main_conf->bind_cache_ttl));
+    if (response_cache_shared && main_conf->response_cache_size > 0)
+        dav_repos_response_cache_child_init(pool,
+                                            main_conf->response_cache_size,
+                                            apr_time_from_sec
+                                            (main_conf->response_cache_ttl));
+    if (acl_cache_shared)
+        dbms_acl_cache_child_init(pool, main_conf->acl_cache_size,
+                                  apr_time_from_sec(main_conf->acl_cache_ttl));
+    if (group_cache_shared)
+        dbms_group_cache_child_init(pool, main_conf->group_cache_size,
+                                    apr_time_from_sec
+                                    (main_conf->group_cache_ttl));
+
+    for (sp = s; sp; sp = sp->next) {
+        dav_repos_db *db = 
+          ap_get_module_config(sp->module_config, &dav_repos_module);
+        if (!db->replica_driver || !db->replica_params)
+            continue;
+
+        db->replica = dbms_api_replica_create(pool, db->replica_driver,
+                                              db->replica_params, threads);
+        if (!db->replica)
+            ap_log_error(APLOG_MARK, APLOG_ERR, 0, sp,
+                         "could not set up the read replica, "
+                         "all requests will use the primary");
+    }
+}
+
 static int dav_repos_create_request(request_rec *r)
 {
     if (r->main) {
@@ -386,8 +905,15 @@ static void register_hooks(apr_pool_t * p)
     /* apache hooks */
     ap_hook_post_config(dav_repos_post_config, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_pre_mpm(dav_repos_pre_mpm, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_child_init(dav_repos_child_init, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_fixups(dav_repos_fixups, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_create_request(dav_repos_create_request, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_handler(dav_repos_retry_handler, NULL, NULL, APR_HOOK_REALLY_FIRST);
+    ap_register_input_filter("DAV_REPOS_REPLAY", dav_repos_replay_filter,
+                             NULL, AP_FTYPE_RESOURCE);
+    ap_register_output_filter(DAV_REPOS_RESPONSE_CACHE_FILTER,
+                              dav_repos_response_cache_filter, NULL,
+                              AP_FTYPE_RESOURCE);
 
     /* live property handling */
     dav_repos_register_liveprops(p);
@@ -35,6 +35,9 @@
 #include <http_request.h>
 #include <http_core.h>		/* for ap_construct_url */
 #include <time.h>
+#include <stdlib.h>             /* for qsort */
+#include <errno.h>
+#include <limits.h>             /* for INT_MAX */
 #include <mod_dav.h>
 
 #include <apr.h>
@@ -42,6 +45,7 @@
 #include <apr_hash.h>
 #include <apr_tables.h>
 #include <apr_file_io.h>
+#include <apr_base64.h>
 
 #include "dav_repos.h"
 #include "dbms.h"
@@ -55,15 +59,25 @@
 #include "liveprops.h"          /* for dav_repos_build_lpr_hash */
 #include "principal.h"          /* for dav_repos_create_user */
 #include "dbms_principal.h"
+#include "dbms_api.h"           /* for dbms_api_is_replica */
+#include "dbms_acl.h"           /* for dbms_is_allow_many */
+#include "response_cache.h"
 
 dav_error *dav_repos_new_resource(request_rec *r, const char *root_path, 
                                   dav_resource **result_resource)
+{
+    return dav_repos_new_resource_in_pool(r, r->pool, root_path,
+                                          result_resource);
+}
+
+dav_error *dav_repos_new_resource_in_pool(request_rec *r, apr_pool_t *pool,
+                                          const char *root_path,
+                                          dav_resource **result_resource)
 {   
     dav_resource_private *ctx;
     dav_resource *resource;
     dav_repos_db *db;
     dav_repos_resource *db_r;
-    apr_pool_t *pool = r->pool;
 
     resource = apr_pcalloc(pool, sizeof(*resource));
     ctx = apr_pcalloc(pool, sizeof(*ctx));
@@ -89,7 +103,7 @@ dav_error *dav_repos_new_resource(request_rec *r, const char *root_path,
 
     resource->info = ctx;
     resource->hooks = &dav_repos_hooks_repos;
-    resource->pool = r->pool;
+    resource->pool = pool;
 
     /* Set return value */
     *result_resource = resource;
@@ -745,99 +759,182 @@ static const char *pretty_print_uri(apr_pool_t *p, const char *req_uri)
     return pretty_uri;
 }
 
-static dav_error *dav_repos_deliver(const dav_resource * resource,
-				    ap_filter_t * output)
+/* the most children a page of a collection index lists */
+#define DAV_REPOS_INDEX_PAGE 1000
+
+/**
+ * Turns the token ending a page of children into the name the next page
+ * starts after
+ */
+static const char *dav_repos_page_after(apr_pool_t *pool, const char *token)
 {
-    char sep = '/';
-    char *ztmp;
+    char *after = apr_palloc(pool, apr_base64_decode_len(token) + 1);
 
-    apr_pool_t *pool = resource->pool;
-    apr_bucket_brigade *bb;
-    apr_status_t status;
-    apr_bucket *bkt;
+    after[apr_base64_decode(after, token)] = '\0';
+    return after;
+}
 
-    dav_repos_db *db = resource->info->db;
-    dav_repos_resource *tmp_r;
-    dav_repos_resource *db_r = (dav_repos_resource *) resource->info->db_r;
-    dav_error *err = NULL;
+/* the token of the page starting after name */
+static const char *dav_repos_page_token(apr_pool_t *pool, const char *name)
+{
+    char *token = apr_palloc(pool, apr_base64_encode_len(strlen(name)));
 
-    TRACE();
+    apr_base64_encode(token, name, strlen(name));
+    return token;
+}
 
-    if (db_r->resourcetype == dav_repos_COLLECTION ||
-        db_r->resourcetype == dav_repos_VERSIONED_COLLECTION) {
-        request_rec *r = resource->info->rec;
-
-        /* redirect to a URL with trailing slash if this is not a sub-request */
-        if (!r->main && r->uri[strlen(r->uri) - 1] != '/') {
-            char *correct_url = apr_pstrcat(pool, dav_get_response_href(r, r->uri), "/",
-                                            r->args ? "?" : NULL, r->args, NULL);
-            apr_table_setn(r->headers_out, "Location", correct_url);
-            return dav_new_error(pool, HTTP_MOVED_PERMANENTLY, 0,
-                                 "Need / at the end of collection");
-        }
+/* the page of an index asked for by the limit and token query arguments */
+static void dav_repos_index_page(request_rec *r, dbms_children_page *page)
+{
+    char *arg, *value, *last = NULL;
 
-        /** 
-         * The html response sent for GET on a collection.
-         */
-	bb = apr_brigade_create(resource->pool, output->c->bucket_alloc);
+    page->limit = DAV_REPOS_INDEX_PAGE;
+    page->after = page->next = NULL;
+    if (r->args == NULL)
+        return;
 
-	/* Will be filled children */
-        err = sabridge_get_collection_children(db, db_r, 1, NULL,
-                                               NULL, NULL, NULL);
-	if (err) return err;
+    for (arg = apr_strtok(apr_pstrdup(r->pool, r->args), "&", &last); arg;
+         arg = apr_strtok(NULL, "&", &last)) {
+        if ((value = strchr(arg, '=')) == NULL)
+            continue;
+        *value++ = '\0';
+        if (ap_unescape_url(value) != OK)
+            continue;
 
-	ap_fprintf(output, bb,
-		   "<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 3.2 Final//EN\">");
+        if (!strcmp(arg, "limit") && atoi(value) > 0
+            && atoi(value) < DAV_REPOS_INDEX_PAGE)
+            page->limit = atoi(value);
+        else if (!strcmp(arg, "token") && *value)
+            page->after = dav_repos_page_after(r->pool, value);
+    }
+}
 
-        ap_fprintf(output, bb, "<html>\n");
+/* what dav_repos_index_child writes the index into */
+typedef struct {
+    apr_pool_t *pool;
+    apr_bucket_brigade *bb;
+} dav_repos_index_baton;
 
-        if (db->css_uri) {
-            ap_fprintf(output, bb, "<head> <link href=\"%s\" rel=\"stylesheet\""
-                       "media=\"screen\" type=\"text/css\"/></head> \n", 
-                       db->css_uri);
-        }
+/* dbms_child_name_fn adding a child to a collection index */
+static dav_error *dav_repos_index_child(void *baton, const char *name,
+                                        int resourcetype)
+{
+    dav_repos_index_baton *ib = baton;
+    const char *slash = (resourcetype == dav_repos_COLLECTION
+                         || resourcetype == dav_repos_VERSIONED_COLLECTION)
+      ? "/" : "";
+
+    apr_brigade_printf(ib->bb, NULL, NULL,
+                       "<li><A HREF=\"%s%s\">%s%s</A><BR>\n",
+                       ap_escape_html(ib->pool,
+                                      ap_escape_path_segment(ib->pool, name)),
+                       slash, ap_escape_html(ib->pool, name), slash);
+    return NULL;
+}
 
-	ap_fprintf(output, bb, "<body>\n <h2>%s</h2>\n", pretty_print_uri(pool, r->uri));
-
-	/* Add '..' */
-	ap_fprintf(output, bb, "\n<ul>\n");
-	ztmp =
-	    apr_pstrndup(pool, db_r->uri,
-			 strrchr(db_r->uri, sep) + 1 - db_r->uri);
-
-        ap_fprintf(output, bb,
-                   "<li><a href=\"../\"><small>../</small></a><br>\n");
-
-        /* Add the children */
-        tmp_r = db_r->next;
-
-	while(tmp_r) {
-            const char *child_basename = basename(tmp_r->uri);
-
-	    /* Collection */
-	    if (tmp_r->resourcetype == dav_repos_COLLECTION) {
-		ap_fprintf(output, bb, "<li><A HREF=\"%s/\">%s/</A><BR>\n",
-			   child_basename, child_basename);
-	    } else {
-		ap_fprintf(output, bb, "<li><A HREF=\"%s\">%s</A><BR>\n",
-			   child_basename, child_basename);
-	    }
-            tmp_r = tmp_r->next;
-	}
-
-	ap_fputs(output, bb,
-		 " </ul>\n <hr noshade><em>Powered by "
-		 "Limestone " VERSION "." "</em>\n</body></html>");
-
-	bkt = apr_bucket_eos_create(output->c->bucket_alloc);
-	APR_BRIGADE_INSERT_TAIL(bb, bkt);
-	if ((status = ap_pass_brigade(output, bb)) != APR_SUCCESS) {
-	    return dav_new_error(resource->pool,
-				 HTTP_INTERNAL_SERVER_ERROR, 0,
-				 "Could not write EOS to filter.");
-	}
-	return NULL;
+/**
+ * Sends the HTML index of a collection: the names of the children the
+ * principal may read, sorted, a page at a time. Indexes are kept in the
+ * response cache, along with the PROPFIND responses
+ * @param resource The collection
+ * @param output The filter to send the index to
+ */
+static dav_error *dav_repos_deliver_index(const dav_resource *resource,
+                                          ap_filter_t *output)
+{
+    request_rec *r = resource->info->rec;
+    apr_pool_t *pool = resource->pool;
+    dav_repos_db *db = resource->info->db;
+    dav_repos_resource *db_r = resource->info->db_r;
+    dav_repos_index_baton ib = { pool, NULL };
+    dbms_children_page page;
+    const char *key, *body;
+    char *html;
+    apr_size_t len;
+    apr_off_t index_len;
+    dav_error *err;
+
+    /* redirect to a URL with trailing slash if this is not a sub-request */
+    if (!r->main && r->uri[strlen(r->uri) - 1] != '/') {
+        char *correct_url = apr_pstrcat(pool, dav_get_response_href(r, r->uri), "/",
+                                        r->args ? "?" : NULL, r->args, NULL);
+        apr_table_setn(r->headers_out, "Location", correct_url);
+        return dav_new_error(pool, HTTP_MOVED_PERMANENTLY, 0,
+                             "Need / at the end of collection");
     }
+
+    ib.bb = apr_brigade_create(pool, output->c->bucket_alloc);
+
+    key = apr_psprintf(pool, "index\n%ld\n%s\n%ld\n%s\n%s\n%s",
+                       db_r->serialno,
+                       db_r->lastmodified ? db_r->lastmodified : "",
+                       dav_repos_get_principal_id
+                         (dav_principal_make_from_request(r)),
+                       r->uri, r->args ? r->args : "",
+                       db->css_uri ? db->css_uri : "");
+    if ((body = dav_repos_response_cache_get(pool, key, &len))) {
+        DBG1("index cache hit: %s", db_r->uri);
+        apr_brigade_write(ib.bb, NULL, NULL, body, len);
+    } else {
+        dav_repos_index_page(r, &page);
+
+        apr_brigade_puts(ib.bb, NULL, NULL,
+                         "<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 3.2 "
+                         "Final//EN\"><html>\n");
+        if (db->css_uri)
+            apr_brigade_printf(ib.bb, NULL, NULL,
+                               "<head> <link href=\"%s\" rel=\"stylesheet\""
+                               "media=\"screen\" type=\"text/css\"/>"
+                               "</head> \n", db->css_uri);
+        apr_brigade_printf(ib.bb, NULL, NULL,
+                           "<body>\n <h2>%s</h2>\n\n<ul>\n"
+                           "<li><a href=\"../\"><small>../</small></a><br>\n",
+                           pretty_print_uri(pool, r->uri));
+
+        err = dbms_get_child_names(db, db_r, "read", &page,
+                                   dav_repos_index_child, &ib);
+        if (err) return err;
+
+        apr_brigade_puts(ib.bb, NULL, NULL, " </ul>\n");
+        if (page.next)
+            apr_brigade_printf(ib.bb, NULL, NULL,
+                               " <a href=\"./?limit=%d&amp;token=%s\">"
+                               "more</a>\n", page.limit,
+                               ap_escape_path_segment
+                                 (pool, dav_repos_page_token(pool, page.next)));
+        apr_brigade_puts(ib.bb, NULL, NULL,
+                         " <hr noshade><em>Powered by "
+                         "Limestone " VERSION "." "</em>\n</body></html>");
+
+        /* a replica may not have the last writes yet */
+        if (!dbms_api_is_replica(db->db)
+            && apr_brigade_pflatten(ib.bb, &html, &len, pool) == APR_SUCCESS)
+            dav_repos_response_cache_set(db->response_generation, key,
+                                         html, len);
+    }
+
+    if (apr_brigade_length(ib.bb, 1, &index_len) == APR_SUCCESS)
+        ap_set_content_length(r, index_len);
+    APR_BRIGADE_INSERT_TAIL(ib.bb,
+                            apr_bucket_eos_create(output->c->bucket_alloc));
+    if (ap_pass_brigade(output, ib.bb) != APR_SUCCESS)
+        return dav_new_error(pool, HTTP_INTERNAL_SERVER_ERROR, 0,
+                             "Could not write EOS to filter.");
+    return NULL;
+}
+
+static dav_error *dav_repos_deliver(const dav_resource * resource,
+				    ap_filter_t * output)
+{
+    dav_repos_db *db = resource->info->db;
+    dav_repos_resource *db_r = (dav_repos_resource *) resource->info->db_r;
+
+    TRACE();
+
+    if (db_r->resourcetype == dav_repos_COLLECTION ||
+        db_r->resourcetype == dav_repos_VERSIONED_COLLECTION)
+        return dav_repos_deliver_index(resource, output);
+
     return sabridge_deliver(db, db_r, output);
 }
 
@@ -1047,9 +1144,341 @@ static dav_error *dav_repos_remove_resource(dav_resource * resource,
     return err;
 }
 
+/**
+ * Call the walker on one resource found by dav_repos_walk
+ * @param params Parameters to determine the walk
+ * @param tmp_r The resource
+ * @param ns_id_hash The namespace ids hash to fill in the props with
+ * @param names The dav_prop_name a PROPFIND asks for, NULL for all
+ * @param response The response pointer.
+ */
+static dav_error *dav_repos_walk_resource(const dav_walk_params * params,
+                                          dav_repos_resource *tmp_r,
+                                          apr_hash_t *ns_id_hash,
+                                          const apr_array_header_t *names,
+                                          dav_response ** response)
+{
+    dav_error *err = NULL;
+    dav_walker_ctx *ctx = params->walk_ctx;
+    dav_walk_resource *wres;
+
+    if ((params->walk_type & DAV_WALKTYPE_IGNORE_BINDS) && tmp_r->bind)
+        return NULL;
+
+    dav_repos_update_dbr_resource(tmp_r);
+
+    /* Make walk resource */
+    wres = apr_pcalloc(params->pool, sizeof(*wres));
+    wres->pool = params->pool;
+    wres->resource = tmp_r->resource;
+    wres->response = response ? *response : NULL;
+    wres->walk_ctx = params->walk_ctx;
+
+    /* 
+     * Build dead/live props hash
+     * Build version props hash
+     * It should be run even it's nulllock
+     */
+    tmp_r->ns_id_hash = ns_id_hash;
+    if (ctx->propfind_type) {
+        dav_repos_build_named_lpr_hash(tmp_r, names);
+    }
+
+    /* Fill lock discovery for propfind prop */
+    if (ctx->propfind_type == DAV_PROPFIND_IS_PROPNAME ||
+        ctx->propfind_type == DAV_PROPFIND_IS_PROP)
+        dav_repos_insert_lock_prop(params, tmp_r);
+
+    /* Call walker */
+    err = (*params->func)
+      (wres, (tmp_r->resourcetype == dav_repos_COLLECTION || 
+              tmp_r->resourcetype == dav_repos_VERSIONED_COLLECTION) ? 
+       DAV_CALLTYPE_COLLECTION : DAV_CALLTYPE_MEMBER);
+
+    /* Save response for now */
+    /* ### maybe add a higher-level description to err? */
+    if (response && (!err || wres->response))
+        *response = wres->response;
+
+    return err;
+}
+
+/* what dav_repos_walk_children needs to go on with a streamed walk */
+typedef struct {
+    const dav_walk_params *params;
+    dav_response **response;
+    const apr_array_header_t *names; /* props asked for, NULL for all */
+    dbms_children_page *page;        /* page of children asked for, NULL
+                                      * for all of them */
+    int acl_prefetch;                /* load the ACEs of each batch */
+} dav_repos_walk_baton;
+
+/**
+ * Loads the ACEs of a list of resources with one query, for the ACL
+ * checks about to be made on each of them while walking
+ * @param params Parameters of the walk
+ * @param list The resources
+ */
+static void dav_repos_walk_prefetch_acl(const dav_walk_params *params,
+                                        dav_repos_resource *list)
+{
+    apr_array_header_t *ids = apr_array_make(list->p, 64, sizeof(long));
+    dav_repos_resource *iter;
+
+    for (iter = list; iter; iter = iter->next)
+        if (!iter->bind)
+            APR_ARRAY_PUSH(ids, long) = iter->serialno;
+
+    /* on failure, the checks query for themselves */
+    dbms_acl_prefetch(params->root->info->db, params->root->info->rec,
+                      list->p, ids);
+}
+
+/**
+ * Decides a privilege on every resource of a list with one batch ACL
+ * check, leaving each verdict in the resource's ace_cache, where the
+ * check mod_dav makes on each member while walking finds it. The ACEs
+ * loaded answer checks of other privileges too
+ * @param params Parameters of the walk
+ * @param list The resources
+ * @param priv The privilege, in the DAV: namespace
+ */
+static void dav_repos_walk_check_acl(const dav_walk_params *params,
+                                     dav_repos_resource *list,
+                                     const char *priv)
+{
+    dav_repos_db *db = params->root->info->db;
+    request_rec *rec = params->root->info->rec;
+    const dav_principal *principal = dav_principal_make_from_request(rec);
+    apr_array_header_t *ids = apr_array_make(list->p, 64, sizeof(long));
+    dav_repos_resource *iter;
+    long priv_ns_id;
+    int *allowed, i;
+
+    for (iter = list; iter; iter = iter->next)
+        APR_ARRAY_PUSH(ids, long) = iter->serialno;
+
+    /* on failure, the checks query for themselves */
+    if (sabridge_get_namespace_id(db, list, "DAV:", &priv_ns_id)
+        || dbms_is_allow_many(db, rec, list->p, priv_ns_id, priv, principal,
+                              ids, &allowed))
+        return;
+
+    for (iter = list, i = 0; iter; iter = iter->next, i++) {
+        iter->ace_cache = apr_pcalloc(iter->p, sizeof(ace_cache_t));
+        iter->ace_cache->principal_id = dav_repos_get_principal_id(principal);
+        iter->ace_cache->priv_ns_id = priv_ns_id;
+        iter->ace_cache->privilege = priv;
+        iter->ace_cache->is_allow = allowed[i];
+    }
+}
+
+/* do the props a PROPFIND asks for, NULL for all, check ACLs */
+static int dav_repos_names_check_acl(const apr_array_header_t *names)
+{
+    int i;
+
+    if (names == NULL)
+        return 1;
+
+    for (i = 0; i < names->nelts; i++) {
+        const dav_prop_name *name = &APR_ARRAY_IDX(names, i, dav_prop_name);
+        if (!strcmp(name->ns, LIMEBITS_NS)
+            || (!strcmp(name->ns, "DAV:")
+                && (!strcmp(name->name, "acl")
+                    || !strcmp(name->name, "current-user-privilege-set"))))
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * Reads the LimeBits page element of a PROPFIND,
+ * <page xmlns="http://limebits.com/ns/1.0/" limit="N" token="T"/>,
+ * asking for N children at most, no more than a page of an index has,
+ * starting after those of the page whose multistatus ended with
+ * <next-token>T</next-token>
+ * @param pool The pool to allocate from
+ * @param doc The body of the PROPFIND
+ * @param err Set when the page element is not right
+ * @return NULL when there is no page element, the page otherwise
+ */
+static dbms_children_page *dav_repos_propfind_page(apr_pool_t *pool,
+                                                   const apr_xml_doc *doc,
+                                                   dav_error **err)
+{
+    dbms_children_page *page;
+    apr_xml_elem *elem;
+    apr_xml_attr *attr;
+    char *end;
+    long limit;
+
+    *err = NULL;
+    for (elem = doc ? doc->root->first_child : NULL; elem; elem = elem->next)
+        if (elem->ns != APR_XML_NS_NONE && !strcmp(elem->name, "page")
+            && !strcmp(APR_XML_GET_URI_ITEM(doc->namespaces, elem->ns),
+                       LIMEBITS_NS))
+            break;
+    if (elem == NULL)
+        return NULL;
+
+    page = apr_pcalloc(pool, sizeof(*page));
+    for (attr = elem->attr; attr; attr = attr->next) {
+        if (!strcmp(attr->name, "limit")) {
+            errno = 0;
+            limit = strtol(attr->value, &end, 10);
+            if (*end || errno || limit <= 0 || limit > INT_MAX)
+                page->limit = 0;
+            else
+                page->limit = limit < DAV_REPOS_INDEX_PAGE ?
+                  limit : DAV_REPOS_INDEX_PAGE;
+        } else if (!strcmp(attr->name, "token") && *attr->value)
+            page->after = dav_repos_page_after(pool, attr->value);
+    }
+
+    if (page->limit == 0)
+        *err = dav_new_error(pool, HTTP_BAD_REQUEST, 0,
+                             "The page element needs a positive limit");
+    return page;
+}
+
+/* the dav_prop_name of the properties a PROPFIND asks for, NULL for all */
+static apr_array_header_t *dav_repos_propfind_names(apr_pool_t *pool,
+                                                    const apr_xml_doc *doc)
+{
+    apr_array_header_t *names;
+    apr_xml_elem *elem, *prop;
+
+    prop = doc ? dav_find_child(doc->root, "prop") : NULL;
+    if (prop == NULL)
+        return NULL;
+
+    names = apr_array_make(pool, 8, sizeof(dav_prop_name));
+    for (elem = prop->first_child; elem; elem = elem->next) {
+        dav_prop_name *name = apr_array_push(names);
+        name->ns = (elem->ns == APR_XML_NS_NONE) ? ""
+          : APR_XML_GET_URI_ITEM(doc->namespaces, elem->ns);
+        name->name = elem->name;
+    }
+    return names;
+}
+
+/* dbms_children_fn calling the walker on a batch read by the cursor */
+static dav_error *dav_repos_walk_children(void *baton,
+                                          dav_repos_resource *children)
+{
+    dav_repos_walk_baton *wb = baton;
+    dav_repos_resource *iter;
+    apr_hash_t *ns_id_hash;
+    dav_error *err;
+
+    /* the batch's pool is cleared after it, keep nothing in it */
+    ns_id_hash = apr_hash_make(children->p);
+    for (iter = children; iter; iter = iter->next)
+        iter->ns_id_hash = ns_id_hash;
+
+    /* the dead props of the whole batch at once */
+    err = dbms_fill_dead_properties(wb->params->root->info->db, children->p,
+                                    children, wb->names);
+    if (err) return err;
+
+    if (wb->acl_prefetch)
+        dav_repos_walk_prefetch_acl(wb->params, children);
+
+    for (iter = children; iter; iter = iter->next) {
+        dav_response *last = wb->response ? *wb->response : NULL;
+
+        err = dav_repos_walk_resource(wb->params, iter, ns_id_hash,
+                                      wb->names, wb->response);
+        if (wb->response && *wb->response && *wb->response != last)
+            (*wb->response)->href = apr_pstrdup(wb->params->pool,
+                                                (*wb->response)->href);
+        if (err) return err;
+    }
+
+    return NULL;
+}
+
+static int dav_repos_strcmp_ptr(const void *a, const void *b)
+{
+    return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+/**
+ * What the responses of a depth 0 or 1 PROPFIND depend on, besides the
+ * writes that bump the response cache's generation
+ * @param r The request
+ * @param db_r The resource walked
+ * @param depth The depth of the walk
+ * @param doc The body of the PROPFIND, NULL for allprop
+ * @return The key of the responses in the response cache
+ */
+static const char *dav_repos_propfind_key(request_rec *r,
+                                                dav_repos_resource *db_r,
+                                                int depth,
+                                                const apr_xml_doc *doc)
+{
+    apr_array_header_t *props = apr_array_make(r->pool, 8, sizeof(char *));
+    apr_xml_elem *elem, *child;
+    const char *host = apr_table_get(r->headers_in, "Host");
+    long principal_id =
+      dav_repos_get_principal_id(dav_principal_make_from_request(r));
+
+    /* the same props asked for in any order */
+    for (elem = doc ? doc->root->first_child : NULL; elem; elem = elem->next) {
+        *(const char **)apr_array_push(props) = elem->name;
+        for (child = elem->first_child; child; child = child->next)
+            *(const char **)apr_array_push(props) = apr_pstrcat
+              (r->pool, elem->name, "/",
+               child->ns == APR_XML_NS_NONE ? ""
+               : APR_XML_GET_URI_ITEM(doc->namespaces, child->ns),
+               " ", child->name, NULL);
+    }
+    qsort(props->elts, props->nelts, props->elt_size, dav_repos_strcmp_ptr);
+
+    /* hrefs are made from the URI and, for LimeBits, the Host */
+    return apr_psprintf(r->pool, "%ld\n%s\n%ld\n%d\n%s\n%s\n%s",
+                        db_r->serialno,
+                        db_r->lastmodified ? db_r->lastmodified : "",
+                        principal_id, depth, host ? host : "", db_r->uri,
+                        apr_array_pstrcat(r->pool, props, '\n'));
+}
+
+/* walk the resource of a PROPFIND, then its children from a cursor */
+static dav_error *dav_repos_walk_propfind(dav_repos_walk_baton *wb,
+                                          int depth, int has_children,
+                                          const char *priv)
+{
+    const dav_walk_params *params = wb->params;
+    dav_repos_db *db = params->root->info->db;
+    dav_repos_resource *db_r = params->root->info->db_r;
+    dav_error *err;
+
+    /* pages after the first one only list children */
+    if (wb->page == NULL || wb->page->after == NULL) {
+        db_r->ns_id_hash = apr_hash_make(params->pool);
+        err = dav_repos_walk_resource(params, db_r, db_r->ns_id_hash,
+                                      wb->names, wb->response);
+        if (err || !has_children) return err;
+    } else if (!has_children)
+        return NULL;
+
+    /* children are read with just the columns the props need */
+    return sabridge_stream_collection_children
+      (db, db_r, depth, priv, dbms_child_columns(wb->names),
+       depth == 1 ? wb->page : NULL, dav_repos_walk_children, wb);
+}
+
 /**
  * Walk the (resource)tree using given params and depth 
  * and populate the response.
+ * For PROPFIND, children are read from a cursor and walked as they come,
+ * a batch at a time with their dead props loaded together, so the
+ * multistatus is streamed out while the resources behind it are freed.
+ * The responses of depth 0 and 1 PROPFINDs are cached, and sent again
+ * for as long as nothing was written.
+ * The ACEs of the resources walked are loaded together when they are
+ * going to be checked, see dbms_acl_prefetch.
  * @param params Parameters to determine the walk 
  * @param depth The level (depth) to which we need to walk.
  * @param response The response pointer.
@@ -1064,7 +1493,10 @@ static dav_error *dav_repos_walk(const dav_walk_params * params, int depth,
     dav_repos_resource *db_r =
 	(dav_repos_resource *) params->root->info->db_r;
     dav_walker_ctx *ctx = params->walk_ctx;
-
+    int has_children = (db_r->resourcetype == dav_repos_COLLECTION
+                        || db_r->resourcetype == dav_repos_VERSIONED_COLLECTION)
+      && depth != 0;
+    char *priv = NULL;
 
     TRACE();
 
@@ -1073,24 +1505,72 @@ static dav_error *dav_repos_walk(const dav_walk_params * params, int depth,
     /* Let's start with NULL response */
     if (response) *response = NULL;
 
+    if (params->walk_type & DAV_WALKTYPE_AUTH)
+        priv = "read";
+
+    if (ctx->propfind_type) {
+        dav_repos_walk_baton wb = { params, response, NULL, NULL, 0 };
+        ap_filter_t *capture = NULL;
+        const char *key = NULL, *body;
+        apr_size_t len;
+
+        if (ctx->propfind_type == DAV_PROPFIND_IS_PROP)
+            wb.names = dav_repos_propfind_names(pool, ctx->doc);
+        wb.acl_prefetch = dav_get_acl_hooks(ctx->r)
+          && dav_repos_names_check_acl(wb.names);
+
+        /* only Depth: 1 listings are paged */
+        wb.page = dav_repos_propfind_page(pool, ctx->doc, &err);
+        if (err) return err;
+        if (depth != 1)
+            wb.page = NULL;
+
+        if (depth <= 1 && wb.page == NULL) {
+            key = dav_repos_propfind_key(ctx->r, db_r, depth, ctx->doc);
+            if ((body = dav_repos_response_cache_get(pool, key, &len))) {
+                DBG1("response cache hit: %s", db_r->uri);
+                ap_fwrite(ctx->r->output_filters, ctx->bb, body, len);
+                return NULL;
+            }
+
+            /* a replica may not have the last writes yet */
+            if (!dbms_api_is_replica(db->db))
+                capture = dav_repos_response_cache_capture(ctx->r, ctx->bb);
+        }
+
+        err = dav_repos_walk_propfind(&wb, depth, has_children, priv);
+
+        if (!err && wb.page && wb.page->next)
+            ap_fputstrs(ctx->r->output_filters, ctx->bb,
+                        "<next-token xmlns=\"" LIMEBITS_NS "\">",
+                        dav_repos_page_token(pool, wb.page->next),
+                        "</next-token>" DEBUG_CR, NULL);
+
+        if (capture)
+            dav_repos_response_cache_put(capture, ctx->bb,
+                                         db->response_generation, key,
+                                         err == NULL);
+        return err;
+    }
+
     /* 
      ** search using mysql 
      ** if not collection or depth=0, we have enough information
      */
-    if ((db_r->resourcetype == dav_repos_COLLECTION
-	 || db_r->resourcetype == dav_repos_VERSIONED_COLLECTION)
-	&& depth != 0) {
+    if (has_children) {
 	/* Will be filled children */
-        char *priv = NULL;
-        if (params->walk_type & DAV_WALKTYPE_AUTH)
-            priv = "read";
 	err = sabridge_get_collection_children
           (db, db_r, depth, priv, NULL, NULL, NULL);
         if (err) return err;
-    }
 
-    if (ctx->propfind_type) {
-        db_r->ns_id_hash = apr_hash_make(pool);
+        /* mod_dav checks the members one by one, of a DELETE, COPY or
+         * MOVE for instance; an authorizing walk checks them for read */
+        if (dav_get_acl_hooks(params->root->info->rec)) {
+            if (priv)
+                dav_repos_walk_check_acl(params, db_r, priv);
+            else
+                dav_repos_walk_prefetch_acl(params, db_r);
+        }
     }
 
     /* 
@@ -1098,49 +1578,9 @@ static dav_error *dav_repos_walk(const dav_walk_params * params, int depth,
      ** assemble walk resource, and call walker
      */
     for (tmp_r = db_r; tmp_r; tmp_r = tmp_r->next) {
-	/* assemble walk resource */
-	dav_walk_resource *wres = apr_pcalloc(pool, sizeof(*wres));
-	dav_resource *resource = tmp_r->resource;
-
-        if ((params->walk_type & DAV_WALKTYPE_IGNORE_BINDS) && tmp_r->bind)
-            continue;
-
-        dav_repos_update_dbr_resource(tmp_r);
-
-	/* Make walk resource */
-	wres->pool = pool;
-	wres->resource = resource;
-	wres->response = response ? *response : NULL;
-	wres->walk_ctx = params->walk_ctx;
-
-	/* 
-	 * Build dead/live props hash
-	 * Build version props hash
-	 * It should be run even it's nulllock
-	 */
-        tmp_r->ns_id_hash = db_r->ns_id_hash;
-        if (ctx->propfind_type) {
-            dav_repos_build_lpr_hash(tmp_r);
-        }
-
-	/* Fill lock discovery for propfind prop */
-	if (ctx->propfind_type == DAV_PROPFIND_IS_PROPNAME ||
-	    ctx->propfind_type == DAV_PROPFIND_IS_PROP)
-	    dav_repos_insert_lock_prop(params, tmp_r);
-
-	/* Call walker */
-	if ((err = (*params->func) 
-             (wres, (tmp_r->resourcetype == dav_repos_COLLECTION || 
-                     tmp_r->resourcetype == dav_repos_VERSIONED_COLLECTION) ? 
-              DAV_CALLTYPE_COLLECTION : DAV_CALLTYPE_MEMBER) ) != NULL) {
-	    /* ### maybe add a higher-level description? */
-            if (response && wres->response)
-                *response = wres->response;
-	    return err;
-	}
-
-        /* Save response for now */
-        if (response) *response = wres->response;
+        err = dav_repos_walk_resource(params, tmp_r, db_r->ns_id_hash,
+                                      NULL, response);
+        if (err) return err;
     }
 
     return NULL;
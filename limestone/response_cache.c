@@ -0,0 +1,213 @@
+/* ====================================================================
+ * Copyright 2007 Lime Spot LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * ====================================================================
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <apr_strings.h>
+
+#include "response_cache.h"
+#include "lru_cache.h"
+
+/* set on requests whose responses must not be cached */
+#define RESPONSE_CACHE_SKIP_NOTE "dav_repos_propfind_uncacheable"
+
+/* no one response may take more than this share of the cache */
+#define RESPONSE_CACHE_ENTRY_SHARE 8
+
+typedef struct {
+    dav_repos_lru_node lru;
+    apr_size_t len;                     /* of the responses */
+    char body[1];                       /* the responses, then the key */
+} response_node;
+
+/* what a capture filter has copied so far */
+typedef struct {
+    request_rec *r;
+    apr_off_t skip;         /* bytes written before the walk, yet to pass */
+    char *buf;
+    apr_size_t len, alloc;
+    int overflow;           /* more than an entry may hold went out */
+} response_capture;
+
+/* bumped on every committed write, holds bytes of responses */
+static dav_repos_lru_cache cache =
+  DAV_REPOS_LRU_CACHE_INIT(cache, "dav_repos_response_cache_shm");
+
+apr_status_t dav_repos_response_cache_init(apr_pool_t *pproc)
+{
+    return dav_repos_lru_cache_init(&cache, pproc);
+}
+
+void dav_repos_response_cache_child_init(apr_pool_t *pchild, apr_size_t size,
+                                         apr_interval_time_t ttl)
+{
+    dav_repos_lru_cache_child_init(&cache, pchild, size, ttl);
+}
+
+apr_uint32_t dav_repos_response_cache_generation(void)
+{
+    return dav_repos_lru_cache_generation(&cache);
+}
+
+void dav_repos_response_cache_invalidate(void)
+{
+    dav_repos_lru_cache_invalidate(&cache);
+}
+
+const char *dav_repos_response_cache_get(apr_pool_t *pool, const char *key,
+                                         apr_size_t *len)
+{
+    response_node *node;
+
+    if (!dav_repos_lru_cache_enabled(&cache))
+        return NULL;
+
+    node = dav_repos_lru_cache_get(&cache, pool,
+                                   dav_repos_lru_cache_generation(&cache),
+                                   key, strlen(key));
+    if (!node)
+        return NULL;
+
+    *len = node->len;
+    return node->body;
+}
+
+/* copies what a bucket holds, past what was written before the walk */
+static void response_capture_bucket(response_capture *capture, apr_bucket *e)
+{
+    const char *data;
+    apr_size_t len, limit = cache.size / RESPONSE_CACHE_ENTRY_SHARE;
+
+    if (capture->overflow || APR_BUCKET_IS_METADATA(e))
+        return;
+    if (apr_bucket_read(e, &data, &len, APR_BLOCK_READ) != APR_SUCCESS) {
+        capture->overflow = 1;
+        return;
+    }
+
+    if (capture->skip) {
+        apr_size_t skip = capture->skip < (apr_off_t)len ?
+          (apr_size_t)capture->skip : len;
+
+        capture->skip -= skip;
+        data += skip;
+        len -= skip;
+    }
+    if (capture->len + len > limit) {
+        capture->overflow = 1;
+        return;
+    }
+
+    if (capture->len + len > capture->alloc) {
+        char *buf;
+
+        capture->alloc = capture->alloc * 2 > capture->len + len ?
+          capture->alloc * 2 : capture->len + len;
+        buf = apr_palloc(capture->r->pool, capture->alloc);
+        if (capture->len)
+            memcpy(buf, capture->buf, capture->len);
+        capture->buf = buf;
+    }
+    memcpy(capture->buf + capture->len, data, len);
+    capture->len += len;
+}
+
+ap_filter_t *dav_repos_response_cache_capture(request_rec *r,
+                                              apr_bucket_brigade *bb)
+{
+    response_capture *capture;
+
+    if (!dav_repos_lru_cache_enabled(&cache)
+        || apr_table_get(r->notes, RESPONSE_CACHE_SKIP_NOTE))
+        return NULL;
+
+    capture = apr_pcalloc(r->pool, sizeof(*capture));
+    capture->r = r;
+    if (apr_brigade_length(bb, 1, &capture->skip) != APR_SUCCESS)
+        return NULL;
+
+    return ap_add_output_filter(DAV_REPOS_RESPONSE_CACHE_FILTER, capture,
+                                r, r->connection);
+}
+
+void dav_repos_response_cache_put(ap_filter_t *f, apr_bucket_brigade *bb,
+                                  apr_uint32_t generation, const char *key,
+                                  int keep)
+{
+    response_capture *capture = f->ctx;
+    apr_bucket *e;
+
+    ap_remove_output_filter(f);
+
+    if (!keep || apr_table_get(capture->r->notes, RESPONSE_CACHE_SKIP_NOTE)
+        || !dav_repos_lru_cache_current(&cache, generation))
+        return;
+
+    /* the rest of the responses has not been sent on yet */
+    for (e = APR_BRIGADE_FIRST(bb); e != APR_BRIGADE_SENTINEL(bb);
+         e = APR_BUCKET_NEXT(e))
+        response_capture_bucket(capture, e);
+    if (capture->overflow || capture->skip)
+        return;
+
+    dav_repos_response_cache_set(generation, key, capture->buf, capture->len);
+}
+
+void dav_repos_response_cache_set(apr_uint32_t generation, const char *key,
+                                  const char *data, apr_size_t len)
+{
+    response_node *node;
+    apr_size_t klen;
+
+    if (len > cache.size / RESPONSE_CACHE_ENTRY_SHARE
+        || !dav_repos_lru_cache_current(&cache, generation))
+        return;
+
+    klen = strlen(key);
+    node = malloc(sizeof(*node) + len + klen);
+    if (!node)
+        return;
+
+    node->len = len;
+    if (len)
+        memcpy(node->body, data, len);
+    memcpy(node->body + len, key, klen + 1);
+    node->lru.key = node->body + len;
+    node->lru.klen = klen;
+    node->lru.alloc = sizeof(*node) + len + klen;
+    node->lru.cost = len;
+
+    dav_repos_lru_cache_put(&cache, generation, &node->lru);
+}
+
+void dav_repos_response_cache_skip(request_rec *r)
+{
+    apr_table_setn(r->notes, RESPONSE_CACHE_SKIP_NOTE, "1");
+}
+
+apr_status_t dav_repos_response_cache_filter(ap_filter_t *f,
+                                             apr_bucket_brigade *bb)
+{
+    apr_bucket *e;
+
+    for (e = APR_BRIGADE_FIRST(bb); e != APR_BRIGADE_SENTINEL(bb);
+         e = APR_BUCKET_NEXT(e))
+        response_capture_bucket(f->ctx, e);
+
+    return ap_pass_brigade(f->next, bb);
+}
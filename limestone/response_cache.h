@@ -0,0 +1,120 @@
+/* ====================================================================
+ * Copyright 2007 Lime Spot LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * ====================================================================
+ */
+
+#ifndef __RESPONSE_CACHE_H__
+#define __RESPONSE_CACHE_H__
+
+#include <httpd.h>
+#include <util_filter.h>
+
+/**
+ * Per-process LRU cache of what is sent for listing requests: the
+ * <DAV:response> elements a depth 0 or 1 PROPFIND walk streams out, and
+ * the HTML indexes of collections, keyed by what they depend on. Every
+ * committed write bumps a generation counter shared by all processes of
+ * the server; entries filled under an older generation are never served.
+ * Writes made by other servers do not bump it, so no entry is served for
+ * longer than the time to live either.
+ */
+
+/* name of the output filter copying a walk's responses */
+#define DAV_REPOS_RESPONSE_CACHE_FILTER "DAV_REPOS_RESPONSE_CACHE"
+
+/**
+ * Sets up the shared generation counter, before the children are forked
+ * @param pproc - The process pool
+ * @return APR_SUCCESS, or why the counter is private to each process
+ */
+apr_status_t dav_repos_response_cache_init(apr_pool_t *pproc);
+
+/**
+ * Sets up this process' cache
+ * @param pchild - The child's pool
+ * @param size - The most bytes of responses to hold, 0 to disable the cache
+ * @param ttl - How long a response is served for
+ */
+void dav_repos_response_cache_child_init(apr_pool_t *pchild, apr_size_t size,
+                                         apr_interval_time_t ttl);
+
+/**
+ * @return The current generation. Read it before the request reads
+ * anything that is going to be put into the cache
+ */
+apr_uint32_t dav_repos_response_cache_generation(void);
+
+/**
+ * Drops every cached response, in this process and all others
+ */
+void dav_repos_response_cache_invalidate(void);
+
+/**
+ * Looks up a response
+ * @param pool - The pool to copy the response into
+ * @param key - What the response depends on
+ * @param len - Set to the length of the response
+ * @return The response, NULL if not found
+ */
+const char *dav_repos_response_cache_get(apr_pool_t *pool, const char *key,
+                                         apr_size_t *len);
+
+/**
+ * Starts copying the responses a walk writes, to be put into the cache
+ * @param r - The request
+ * @param bb - The brigade the walk writes to, whatever is in it already is
+ * not copied
+ * @return The capture filter, NULL if nothing would be cached
+ */
+ap_filter_t *dav_repos_response_cache_capture(request_rec *r,
+                                              apr_bucket_brigade *bb);
+
+/**
+ * Stops copying and remembers the responses, unless the request was
+ * marked as not to be cached
+ * @param f - The capture filter
+ * @param bb - The brigade the walk wrote to, whose buckets have yet to
+ * pass the filter
+ * @param generation - The generation read before the request read anything
+ * @param key - What the responses depend on
+ * @param keep - Zero to drop what was copied
+ */
+void dav_repos_response_cache_put(ap_filter_t *f, apr_bucket_brigade *bb,
+                                  apr_uint32_t generation, const char *key,
+                                  int keep);
+
+/**
+ * Remembers a response rendered whole
+ * @param generation - The generation read before the request read anything
+ * @param key - What the response depends on
+ * @param data - The response
+ * @param len - The length of the response
+ */
+void dav_repos_response_cache_set(apr_uint32_t generation, const char *key,
+                                  const char *data, apr_size_t len);
+
+/**
+ * Keeps the responses of this request out of the cache, for what they
+ * show that changes without a write, such as lock timeouts
+ * @param r - The request
+ */
+void dav_repos_response_cache_skip(request_rec *r);
+
+/* output filter copying the responses of a walk */
+apr_status_t dav_repos_response_cache_filter(ap_filter_t *f,
+                                             apr_bucket_brigade *bb);
+
+#endif /* __RESPONSE_CACHE_H__ */
@@ -112,6 +112,7 @@ static dav_error *dav_repos_search_resource(request_rec * r,
 
     /* Execute the query */
     q = dbms_prepare(r->pool, db_handle->db, sctx->query);
+    dbms_set_fetch_size(q, db_handle->fetch_size);
     if (dbms_execute(q)) {
 	dbms_query_destroy(q);
 	return dav_new_error(r->pool, HTTP_INTERNAL_SERVER_ERROR, 0,
@@ -122,8 +123,9 @@ static dav_error *dav_repos_search_resource(request_rec * r,
     sctx->q = q;
 
     /* Build the XML response */
-    if ((result = build_xml_response(r->pool, sctx, res) != HTTP_OK)) {
-	return dav_new_error(r->pool, HTTP_BAD_REQUEST, 0,
+    if ((result = build_xml_response(r->pool, sctx, res)) != HTTP_OK) {
+	dbms_query_destroy(q);
+	return dav_new_error(r->pool, result, 0,
 			     "An error occurred while building XML response!");
     }
 
@@ -1000,12 +1002,14 @@ int parse_offset(request_rec * r, search_ctx * sctx,
  * Builds the XML body of the response from the SQL query results
  * @param r The method request record
  * @param search_results The result(s) of the SQL query
+ * @return HTTP_OK, or HTTP_INTERNAL_SERVER_ERROR if the results could not
+ * all be read
  */
 int build_xml_response(apr_pool_t *pool, search_ctx *sctx, dav_response ** res)
 {
     dav_response *tail;
-    char **dbrow, **good_props, **bad_props;
-    int i, results_count = 0, j, k;
+    char **dbrow = NULL, **good_props, **bad_props;
+    int done, j, k, ierrno;
     const char *last_href = NULL, *href;
     apr_hash_t *bitmarks = NULL;
     apr_hash_index_t *hi;
@@ -1021,15 +1025,17 @@ int build_xml_response(apr_pool_t *pool, search_ctx *sctx, dav_response ** res)
     good_props = apr_pcalloc(pool, sizeof(char *));
     bad_props = apr_pcalloc(pool, sizeof(char *));
     
-    results_count = dbms_results_count(sctx->q);
-
-    for(i=0; i<results_count+1; i++) {
-        if (i != results_count) {
-            dbrow = dbms_fetch_row_num(sctx->db->db, sctx->q, pool, i);
+    /* one extra pass after the last row flushes the final response */
+    do {
+        /* a failed fetch is not the end of the results */
+        if ((ierrno = dbms_next(sctx->q)) < 0)
+            return HTTP_INTERNAL_SERVER_ERROR;
+        if (!(done = ierrno == 0)) {
+            dbrow = dbms_get_row(sctx->q, pool);
             href = dbrow[0];
         }
         
-        if (!last_href || apr_strnatcmp(href, last_href) != 0 || i == results_count ) {
+        if (!last_href || done || apr_strnatcmp(href, last_href) != 0) {
             if (last_href) {
                 apr_text_header hdr = { 0 };
 
@@ -1134,7 +1140,7 @@ int build_xml_response(apr_pool_t *pool, search_ctx *sctx, dav_response ** res)
                 }
             }
 
-            if ( i != results_count ) {
+            if (!done) {
                 /* for each result build dav_response */
                 j = search_mkresponse(pool, sctx, dbrow, good_props, bad_props);
                 last_href = apr_pstrdup(pool, href);
@@ -1151,7 +1157,7 @@ int build_xml_response(apr_pool_t *pool, search_ctx *sctx, dav_response ** res)
             }
         }
         
-        if (bitmarks && dbrow[j]) {
+        if (!done && bitmarks && dbrow[j]) {
             next = apr_strtok(apr_pstrdup(pool, dbrow[j]), ">", &last);
             while(next) {
                 values = apr_hash_get(bitmarks, next, 
@@ -1168,7 +1174,7 @@ int build_xml_response(apr_pool_t *pool, search_ctx *sctx, dav_response ** res)
             }
         }
          
-    }
+    } while (!done);
 
     return HTTP_OK;
 }
@@ -1,7 +1,86 @@
+#include <httpd.h>
+#include <http_config.h>
+#include <http_log.h>
+#include <http_protocol.h>
+#include <util_filter.h>
+#include <apr_buckets.h>
+#include <apr_general.h>     /* for apr_generate_random_bytes */
+#include <apr_strings.h>
+
 #include "transaction.h"
 #include "dbms_transaction.h"
 #include "dbms_api.h"
+#include "dbms.h"
 #include "dav_repos.h"
+#include "response_cache.h"    /* for dav_repos_response_cache_invalidate */
+
+extern module AP_MODULE_DECLARE_DATA dav_repos_module;
+
+/* carry the id of a client's last write, see dav_repos_set_written_txid */
+#define DAV_REPOS_TXID_COOKIE "LimestoneTxid"
+#define DAV_REPOS_TXID_HEADER "X-Limestone-Txid"
+
+/* set while the DAV handler runs under the retry loop */
+#define DAV_REPOS_RETRY_NOTE "dav_repos_retrying"
+
+/* first backoff before retrying, doubled on every further attempt */
+#define DAV_REPOS_RETRY_BACKOFF apr_time_from_msec(10)
+
+typedef struct {
+    apr_bucket_brigade *body;   /* the request body read so far */
+    int complete;               /* body holds everything up to EOS */
+    apr_bucket_brigade *replay; /* what is left to hand out this attempt */
+} dav_repos_replay_ctx;
+
+/**
+ * Methods that only read run in a read-only transaction, unless an earlier
+ * attempt at the request found that it writes after all
+ */
+int dav_repos_is_read_only_request(request_rec *r)
+{
+    if (apr_table_get(r->notes, "xaction_read_write"))
+        return 0;
+
+    switch (r->method_number) {
+    case M_GET:         /* and HEAD */
+    case M_OPTIONS:
+    case M_PROPFIND:
+    case M_REPORT:
+        return 1;
+    }
+    return !strcmp(r->method, "SEARCH");
+}
+
+/**
+ * Tells the client which transaction its write committed as, so that its
+ * reads can stay off a replica that has not replayed it yet
+ */
+static void dav_repos_set_written_txid(request_rec *r, dav_repos_db *db,
+                                       long txid)
+{
+    apr_table_addn(r->err_headers_out, "Set-Cookie",
+                   apr_psprintf(r->pool, "%s=%ld; Path=/; Max-Age=%d",
+                                DAV_REPOS_TXID_COOKIE, txid,
+                                db->replica_sticky));
+    apr_table_setn(r->err_headers_out, DAV_REPOS_TXID_HEADER,
+                   apr_ltoa(r->pool, txid));
+}
+
+long dav_repos_get_written_txid(request_rec *r)
+{
+    const char *value, *cookies;
+
+    if ((value = apr_table_get(r->headers_in, DAV_REPOS_TXID_HEADER)))
+        return atol(value);
+
+    for (cookies = apr_table_get(r->headers_in, "Cookie");
+         cookies && (value = strstr(cookies, DAV_REPOS_TXID_COOKIE "="));
+         cookies = value + 1) {
+        if (value == cookies || value[-1] == ' ' || value[-1] == ';')
+            return atol(value + sizeof(DAV_REPOS_TXID_COOKIE));
+    }
+    return 0;
+}
 
 dav_error *dav_repos_transaction_start(request_rec *r, dav_transaction **t)
 {
@@ -17,13 +96,19 @@ dav_error *dav_repos_transaction_start(request_rec *r, dav_transaction **t)
         return dav_new_error(pool, HTTP_INTERNAL_SERVER_ERROR, 0,
                              "Couldn't initialize connection with database");
 
-    if(0 != (ierrno = dbms_transaction_start(pool, db, &db_trans)))
+    if (dav_repos_is_read_only_request(r))
+        ierrno = dbms_transaction_start_read_only(pool, db, &db_trans);
+    else
+        ierrno = dbms_transaction_start(pool, db, &db_trans);
+
+    if(0 != ierrno)
        return dav_new_error(pool, HTTP_INTERNAL_SERVER_ERROR, ierrno,
                             "failed to start transaction");
 
     *t = apr_pcalloc(pool, sizeof(**t));
     (*t)->info = apr_pcalloc(pool, sizeof(dav_transaction_private));
     (*t)->info->db_trans = db_trans;
+    (*t)->info->r = r;
     (*t)->mode = DAV_TRANSACTION_COMMIT;
 
     return NULL;
@@ -46,6 +131,10 @@ static dav_error *dav_repos_transaction_pre_commit_checks(dav_transaction *t)
 
     TRACE();
 
+    /* nothing can have changed */
+    if (db_trans->read_only)
+        return NULL;
+
     if((err = dbms_quota_pre_commit_checks(pool, db_trans->db))
         && t->mode != DAV_TRANSACTION_IGNORE_ERRORS) {
         t->mode = dbms_transaction_mode_set(db_trans, DAV_TRANSACTION_ROLLBACK);
@@ -62,6 +151,8 @@ static dav_error *dav_repos_transaction_pre_commit_checks(dav_transaction *t)
 dav_error *dav_repos_transaction_end(dav_transaction *t)
 {
     dav_repos_transaction *db_trans = t->info->db_trans;
+    dav_repos_db *db;
+    long txid = 0;
     int ierrno;
     dav_error *err;
 
@@ -69,10 +160,31 @@ dav_error *dav_repos_transaction_end(dav_transaction *t)
 
     err = dav_repos_transaction_pre_commit_checks(t);
 
+    db = dav_repos_get_db(t->info->r);
+
+    /* statements failed for the query budget were skipped, whether or not
+     * their callers noticed; none of the rest may be committed */
+    if (dbms_api_over_budget(db->db)) {
+        t->mode = dbms_transaction_mode_set(db_trans, DAV_TRANSACTION_ROLLBACK);
+        err = dav_new_error(db_trans->pool, HTTP_INTERNAL_SERVER_ERROR, 0,
+                            "queries ran beyond their budget, rolled back");
+    }
+
+    if (db->replica && !db_trans->read_only
+        && t->mode != DAV_TRANSACTION_ROLLBACK)
+        txid = dbms_get_current_txid(db_trans->pool, db);
+
     ierrno = dbms_transaction_end(db_trans);
     if (ierrno)
         err = dav_new_error(db_trans->pool, HTTP_INTERNAL_SERVER_ERROR, ierrno,
                             "failed to end transaction");
+    else if (txid)
+        dav_repos_set_written_txid(t->info->r, db, txid);
+
+    /* whatever was written may show in a cached PROPFIND */
+    if (!ierrno && !db_trans->read_only && t->mode != DAV_TRANSACTION_ROLLBACK
+        && !dav_repos_is_read_only_request(t->info->r))
+        dav_repos_response_cache_invalidate();
     return err;
 }
 
@@ -82,3 +194,229 @@ const dav_hooks_transaction dav_repos_hooks_transaction = {
     dav_repos_transaction_end,
     NULL
 };
+
+/* Input filter handing the buffered request body to each attempt */
+apr_status_t dav_repos_replay_filter(ap_filter_t *f, apr_bucket_brigade *bb,
+                                     ap_input_mode_t mode,
+                                     apr_read_type_e block, apr_off_t readbytes)
+{
+    dav_repos_replay_ctx *ctx = f->ctx;
+    apr_bucket *e, *split;
+
+    if (APR_BRIGADE_EMPTY(ctx->replay)) {
+        if (ctx->complete) {
+            e = apr_bucket_eos_create(f->c->bucket_alloc);
+            APR_BRIGADE_INSERT_TAIL(bb, e);
+            return APR_SUCCESS;
+        }
+        return ap_get_brigade(f->next, bb, mode, block, readbytes);
+    }
+
+    if (mode == AP_MODE_READBYTES && readbytes > 0)
+        apr_brigade_partition(ctx->replay, readbytes, &split);
+    else
+        split = APR_BRIGADE_SENTINEL(ctx->replay);
+
+    while ((e = APR_BRIGADE_FIRST(ctx->replay)) != split) {
+        APR_BUCKET_REMOVE(e);
+        APR_BRIGADE_INSERT_TAIL(bb, e);
+    }
+    return APR_SUCCESS;
+}
+
+/**
+ * Reads up to limit bytes of the request body into memory and installs the
+ * replay filter in front of the request's input
+ * @return the replay context
+ */
+static dav_repos_replay_ctx *dav_repos_buffer_body(request_rec *r,
+                                                   apr_off_t limit)
+{
+    dav_repos_replay_ctx *ctx = apr_pcalloc(r->pool, sizeof(*ctx));
+    apr_bucket_brigade *bb;
+    apr_bucket *e;
+    apr_off_t length = 0;
+
+    ctx->body = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+    ctx->replay = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+    bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+
+    while (!ctx->complete && length <= limit) {
+        if (ap_get_brigade(r->input_filters, bb, AP_MODE_READBYTES,
+                           APR_BLOCK_READ, HUGE_STRING_LEN) != APR_SUCCESS)
+            break;
+
+        while (!APR_BRIGADE_EMPTY(bb)) {
+            e = APR_BRIGADE_FIRST(bb);
+            if (APR_BUCKET_IS_EOS(e))
+                ctx->complete = 1;
+            else
+                length += e->length;
+            apr_bucket_setaside(e, r->pool);
+            APR_BUCKET_REMOVE(e);
+            APR_BRIGADE_INSERT_TAIL(ctx->body, e);
+        }
+    }
+
+    ap_add_input_filter("DAV_REPOS_REPLAY", ctx, r, r->connection);
+    return ctx;
+}
+
+static void dav_repos_rewind_body(dav_repos_replay_ctx *ctx)
+{
+    apr_bucket *e, *copy;
+
+    apr_brigade_cleanup(ctx->replay);
+    for (e = APR_BRIGADE_FIRST(ctx->body);
+         e != APR_BRIGADE_SENTINEL(ctx->body); e = APR_BUCKET_NEXT(e)) {
+        apr_bucket_copy(e, &copy);
+        APR_BRIGADE_INSERT_TAIL(ctx->replay, copy);
+    }
+}
+
+/**
+ * Methods that write bodies into the content store or remove them from
+ * it are not rerun, since nothing undoes what a failed attempt did to the
+ * files
+ */
+static int dav_repos_is_retryable_request(request_rec *r)
+{
+    switch (r->method_number) {
+    case M_PUT:
+    case M_DELETE:
+    case M_COPY:
+    case M_MOVE:
+    case M_VERSION_CONTROL:
+    case M_CHECKOUT:
+    case M_UNCHECKOUT:
+    case M_CHECKIN:
+        return 0;
+    }
+    return strcmp(r->method, "BIND") && strcmp(r->method, "UNBIND")
+      && strcmp(r->method, "REBIND");
+}
+
+/**
+ * Fails a request whose transaction was rolled back for going over the
+ * query budget, unless its response is on its way already
+ * @param r The request
+ * @param status What the DAV handler returned
+ * @return the status to return
+ */
+static int dav_repos_budget_status(request_rec *r, int status)
+{
+    dav_repos_db *db = ap_get_module_config(r->request_config,
+                                            &dav_repos_module);
+
+    if (db && db->db && dbms_api_over_budget(db->db)
+        && !r->sent_bodyct && !r->bytes_sent
+        && !ap_is_HTTP_ERROR(status) && !ap_is_HTTP_ERROR(r->status))
+        return HTTP_INTERNAL_SERVER_ERROR;
+    return status;
+}
+
+/**
+ * Runs the DAV handler, and runs it again, after rolling back, whenever
+ * its transaction failed to serialize with a concurrent one and nothing
+ * has been sent to the client yet. Attempts are spaced out with jittered
+ * exponential backoff. Only requests this provider serves are run, and of
+ * those only the ones that leave the content store alone.
+ */
+int dav_repos_retry_handler(request_rec *r)
+{
+    dav_repos_server_conf *conf;
+    dav_repos_replay_ctx *ctx = NULL;
+    apr_table_t *notes, *headers_out, *err_headers_out;
+    const char *content_type, *length = NULL;
+    apr_interval_time_t delay;
+    apr_uint32_t jitter;
+    int attempt, status;
+
+    if (!r->handler || strcmp(r->handler, "dav-handler") || r->main
+        || apr_table_get(r->notes, DAV_REPOS_RETRY_NOTE))
+        return DECLINED;
+
+    /* locations served by other DAV providers are none of our business */
+    if (dav_get_acl_hooks(r) != &dav_repos_hooks_acl
+        || !dav_repos_is_retryable_request(r))
+        return DECLINED;
+
+    conf = ap_get_module_config(r->server->module_config, &dav_repos_module);
+    if (conf->xaction_retries <= 0)
+        return DECLINED;
+
+    if (apr_table_get(r->headers_in, "Transfer-Encoding")
+        || ((length = apr_table_get(r->headers_in, "Content-Length"))
+            && apr_atoi64(length) > 0)) {
+        if (length && apr_atoi64(length) > conf->retry_body_limit)
+            return DECLINED;
+        ctx = dav_repos_buffer_body(r, conf->retry_body_limit);
+        if (!ctx->complete) {
+            /* too big to be replayed; hand out what was read and the rest
+             * of the body once */
+            dav_repos_rewind_body(ctx);
+            return DECLINED;
+        }
+    }
+
+    apr_table_unset(r->notes, "xaction_error");
+    notes = apr_table_copy(r->pool, r->notes);
+    headers_out = apr_table_copy(r->pool, r->headers_out);
+    err_headers_out = apr_table_copy(r->pool, r->err_headers_out);
+    content_type = r->content_type;
+
+    for (attempt = 0; ; attempt++) {
+        if (ctx)
+            dav_repos_rewind_body(ctx);
+        apr_table_setn(r->notes, DAV_REPOS_RETRY_NOTE, "1");
+
+        status = ap_run_handler(r);
+
+        if (!apr_table_get(r->notes, "xaction_error"))
+            break;
+        if (apr_table_get(r->notes, "xaction_read_write")) {
+            dav_repos_db *db = ap_get_module_config(r->request_config,
+                                                    &dav_repos_module);
+            apr_table_setn(notes, "xaction_read_write", "1");
+
+            /* the rerun has to write, which only the primary can do */
+            if (db && dbms_api_is_replica(db->db)) {
+                dbms_closedb(db);
+                ap_set_module_config(r->request_config, &dav_repos_module,
+                                     NULL);
+            }
+        }
+        if (attempt >= conf->xaction_retries || r->sent_bodyct || r->bytes_sent) {
+            ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r,
+                          "serialization failure, giving up after %d "
+                          "retries", attempt);
+            break;
+        }
+
+        delay = DAV_REPOS_RETRY_BACKOFF << attempt;
+        if (apr_generate_random_bytes((unsigned char *)&jitter,
+                                      sizeof(jitter)) == APR_SUCCESS)
+            delay = delay / 2 + jitter % (delay / 2 + 1);
+
+        ap_log_rerror(APLOG_MARK, APLOG_NOTICE, 0, r,
+                      "serialization failure, retrying (attempt %d of %d) "
+                      "in %" APR_TIME_T_FMT "ms", attempt + 1,
+                      conf->xaction_retries, apr_time_as_msec(delay));
+        apr_sleep(delay);
+
+        /* start over from the state the request was in */
+        r->status = HTTP_OK;
+        r->status_line = NULL;
+        r->read_length = 0;
+        r->notes = apr_table_copy(r->pool, notes);
+        r->headers_out = apr_table_copy(r->pool, headers_out);
+        r->err_headers_out = apr_table_copy(r->pool, err_headers_out);
+        r->content_type = content_type;
+    }
+
+    if (attempt && !apr_table_get(r->notes, "xaction_error"))
+        ap_log_rerror(APLOG_MARK, APLOG_NOTICE, 0, r,
+                      "succeeded after %d serialization failure retries",
+                      attempt);
+    return dav_repos_budget_status(r, status);
+}
@@ -1,6 +1,8 @@
 #ifndef TRANSACTION_H
 #define TRANSACTION_H
 
+#include <util_filter.h>
+
 #include "dbms_transaction.h"
 
 /* Uniform interface for DB-FS transactions */
@@ -11,12 +13,29 @@ struct dav_transaction_private
 
     /* DB transaction struct, to be filled by DAL */
     dav_repos_transaction *db_trans;
+
+    /* the request the transaction belongs to */
+    request_rec *r;
 };
 
+/* does the request only read, so that it can run READ ONLY */
+int dav_repos_is_read_only_request(request_rec *r);
+
+/* id of the last transaction the client wrote, 0 if it did not say */
+long dav_repos_get_written_txid(request_rec *r);
+
 dav_error *dav_repos_transaction_start(request_rec *r, dav_transaction **t);
 
 int dav_repos_transaction_mode_set(dav_transaction *t, int mode);
 
 dav_error *dav_repos_transaction_end(dav_transaction *t);
 
+/* handler hook re-running DAV requests that failed to serialize */
+int dav_repos_retry_handler(request_rec *r);
+
+/* input filter replaying the request body to retried requests */
+apr_status_t dav_repos_replay_filter(ap_filter_t *f, apr_bucket_brigade *bb,
+                                     ap_input_mode_t mode,
+                                     apr_read_type_e block, apr_off_t readbytes);
+
 #endif  /* ifndef TRANSACTION_H */